@@ -0,0 +1,287 @@
+/* picoc benchmark harness. runs each benchmark script under picoc a number of times
+ * and reports the median wall time, instructions per second and peak RSS as
+ * tab-separated values, so the reports from two builds of picoc can be compared.
+ *
+ * build it with:   g++ -O2 -o picoc-bench bench/bench.cpp
+ * run it with:     ./picoc-bench [-n <runs>] [-p <picoc>] [-d <script dir>] [-b <baseline.tsv>] [<benchmark>...]
+ *
+ * the "startup" benchmark runs an empty program so it measures starting up and
+ * shutting down. instruction counts need Linux perf events and are shown as "-"
+ * where those aren't available */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+constexpr int BENCH_RUNS_DEFAULT = 5;			/* runs of each benchmark */
+constexpr int BENCH_RUNS_MAX = 99;
+constexpr int BENCH_MAX = 64;					/* benchmarks which can be named on the command line */
+constexpr int BENCH_LINE_MAX = 256;				/* longest line of a baseline file */
+
+/* the benchmarks run when none are named */
+static const char *DefaultBenchmarks[] =
+{
+	"startup", "fib", "sieve", "nbody", "structs", "strings", "printf", "statemachine", "recursion", nullptr
+};
+
+/* what one run of a benchmark took */
+struct BenchRun
+{
+	long long WallNs;
+	long MaxRssKb;
+	long long Instructions;		/* -1 if they couldn't be counted */
+};
+
+/* a benchmark's median wall time from an earlier report */
+struct BaselineEntry
+{
+	char Name[64];
+	double WallMs;
+};
+
+static struct BaselineEntry Baseline[BENCH_MAX];
+static int NumBaseline = 0;
+
+static long long BenchNow()
+{
+	struct timespec Now;
+
+	clock_gettime(CLOCK_MONOTONIC, &Now);
+	return (long long)Now.tv_sec * 1000000000LL + Now.tv_nsec;
+}
+
+/* count the instructions a process runs in user space once it calls exec(). returns -1
+ * if they can't be counted */
+static int BenchOpenCounter(pid_t Pid)
+{
+#ifdef __linux__
+	struct perf_event_attr Attr;
+
+	memset((void *)&Attr, '\0', sizeof(Attr));
+	Attr.type = PERF_TYPE_HARDWARE;
+	Attr.size = sizeof(Attr);
+	Attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+	Attr.disabled = 1;
+	Attr.enable_on_exec = 1;
+	Attr.exclude_kernel = 1;
+	Attr.exclude_hv = 1;
+	return syscall(SYS_perf_event_open, &Attr, Pid, -1, -1, 0);
+#else
+	return -1;
+#endif
+}
+
+/* run a script under picoc once with its output discarded. returns false if it failed */
+static bool BenchRunOnce(const char *Picoc, const char *Script, struct BenchRun *Run)
+{
+	int Go[2];
+	int Counter;
+	int Status;
+	long long StartNs;
+	struct rusage Usage;
+	pid_t Pid;
+	char Ch = 0;
+
+	if (pipe(Go) != 0)
+		return false;
+
+	Pid = fork();
+	if (Pid < 0)
+		return false;
+
+	if (Pid == 0)
+	{
+		/* wait until the parent is ready to measure us */
+		int Null = open("/dev/null", O_WRONLY);
+
+		close(Go[1]);
+		if (read(Go[0], &Ch, 1) < 0)
+			_exit(127);
+
+		dup2(Null, STDOUT_FILENO);
+		execl(Picoc, Picoc, Script, (char *)nullptr);
+		_exit(127);
+	}
+
+	close(Go[0]);
+	Counter = BenchOpenCounter(Pid);
+	StartNs = BenchNow();
+	close(Go[1]);
+
+	if (wait4(Pid, &Status, 0, &Usage) != Pid)
+		return false;
+
+	Run->WallNs = BenchNow() - StartNs;
+	Run->MaxRssKb = Usage.ru_maxrss;
+	Run->Instructions = -1;
+	if (Counter >= 0)
+	{
+		long long Count;
+
+		if (read(Counter, &Count, sizeof(Count)) == sizeof(Count))
+			Run->Instructions = Count;
+
+		close(Counter);
+	}
+
+	return WIFEXITED(Status) && WEXITSTATUS(Status) == 0;
+}
+
+static int BenchCompareWall(const void *A, const void *B)
+{
+	long long WallA = ((const struct BenchRun *)A)->WallNs;
+	long long WallB = ((const struct BenchRun *)B)->WallNs;
+
+	return (WallA > WallB) - (WallA < WallB);
+}
+
+/* read the median wall times from a report written earlier */
+static void BenchReadBaseline(const char *FileName)
+{
+	char Line[BENCH_LINE_MAX];
+	FILE *In = fopen(FileName, "r");
+
+	if (In == nullptr)
+	{
+		fprintf(stderr, "can't read baseline %s\n", FileName);
+		exit(1);
+	}
+
+	while (fgets(Line, sizeof(Line), In) != nullptr && NumBaseline < BENCH_MAX)
+	{
+		struct BaselineEntry *Entry = &Baseline[NumBaseline];
+
+		if (Line[0] == '#' || strncmp(Line, "benchmark\t", 10) == 0)
+			continue;
+
+		if (sscanf(Line, "%63[^\t]\t%lf", Entry->Name, &Entry->WallMs) == 2)
+			NumBaseline++;
+	}
+
+	fclose(In);
+}
+
+static double BenchBaselineWall(const char *Name)
+{
+	int Count;
+
+	for (Count = 0; Count < NumBaseline; Count++)
+	{
+		if (strcmp(Baseline[Count].Name, Name) == 0)
+			return Baseline[Count].WallMs;
+	}
+
+	return 0.0;
+}
+
+/* run one benchmark and print its line of the report. returns false if it failed */
+static bool BenchRunOne(const char *Picoc, const char *Dir, const char *Name, int NumRuns)
+{
+	struct BenchRun Runs[BENCH_RUNS_MAX];
+	char Script[BENCH_LINE_MAX];
+	long long Instructions = 0;
+	long MaxRssKb = 0;
+	double WallMs;
+	double BaseMs;
+	int Count;
+
+	snprintf(Script, sizeof(Script), "%s/%s.c", Dir, Name);
+	for (Count = 0; Count < NumRuns; Count++)
+	{
+		if (!BenchRunOnce(Picoc, Script, &Runs[Count]))
+		{
+			fprintf(stderr, "%s failed\n", Script);
+			return false;
+		}
+
+		if (Runs[Count].MaxRssKb > MaxRssKb)
+			MaxRssKb = Runs[Count].MaxRssKb;
+	}
+
+	qsort((void *)&Runs[0], NumRuns, sizeof(Runs[0]), BenchCompareWall);
+	WallMs = Runs[NumRuns / 2].WallNs / 1e6;
+	printf("%s\t%.2f\t%.2f\t%.2f\t", Name, WallMs, Runs[0].WallNs / 1e6, Runs[NumRuns-1].WallNs / 1e6);
+
+	/* instructions per second of the median run */
+	Instructions = Runs[NumRuns / 2].Instructions;
+	if (Instructions >= 0)
+		printf("%.1f", Instructions / 1e6 / (WallMs / 1e3));
+	else
+		printf("-");
+
+	printf("\t%ld", MaxRssKb);
+	if (NumBaseline > 0)
+	{
+		BaseMs = BenchBaselineWall(Name);
+		if (BaseMs > 0.0)
+			printf("\t%.3f", WallMs / BaseMs);
+		else
+			printf("\t-");
+	}
+
+	printf("\n");
+	fflush(stdout);
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+	const char *Picoc = "./picoc";
+	const char *Dir = "bench";
+	const char *Benchmarks[BENCH_MAX];
+	int NumBenchmarks = 0;
+	int NumRuns = BENCH_RUNS_DEFAULT;
+	int Failed = 0;
+	int Opt;
+	int Count;
+
+	while ((Opt = getopt(argc, argv, "n:p:d:b:")) != -1)
+	{
+		switch (Opt)
+		{
+			case 'n': NumRuns = atoi(optarg); break;
+			case 'p': Picoc = optarg; break;
+			case 'd': Dir = optarg; break;
+			case 'b': BenchReadBaseline(optarg); break;
+			default:
+				fprintf(stderr, "Format: picoc-bench [-n <runs>] [-p <picoc>] [-d <script dir>] [-b <baseline.tsv>] [<benchmark>...]\n");
+				return 1;
+		}
+	}
+
+	if (NumRuns < 1 || NumRuns > BENCH_RUNS_MAX)
+	{
+		fprintf(stderr, "the number of runs must be from 1 to %d\n", BENCH_RUNS_MAX);
+		return 1;
+	}
+
+	for (Count = optind; Count < argc && NumBenchmarks < BENCH_MAX; Count++)
+		Benchmarks[NumBenchmarks++] = argv[Count];
+
+	if (NumBenchmarks == 0)
+	{
+		for (Count = 0; DefaultBenchmarks[Count] != nullptr; Count++)
+			Benchmarks[NumBenchmarks++] = DefaultBenchmarks[Count];
+	}
+
+	printf("# %s, median of %d runs\n", Picoc, NumRuns);
+	printf("benchmark\twall_ms\tmin_ms\tmax_ms\tMinstr_per_s\tpeak_rss_kb%s\n", NumBaseline > 0 ? "\tvs_baseline" : "");
+	for (Count = 0; Count < NumBenchmarks; Count++)
+	{
+		if (!BenchRunOne(Picoc, Dir, Benchmarks[Count], NumRuns))
+			Failed++;
+	}
+
+	return Failed > 0;
+}
@@ -0,0 +1,16 @@
+/* recursive fibonacci - function call overhead */
+#include <stdio.h>
+
+int Fib(int N)
+{
+    if (N < 2)
+        return N;
+
+    return Fib(N - 1) + Fib(N - 2);
+}
+
+int main()
+{
+    printf("%d\n", Fib(24));
+    return 0;
+}
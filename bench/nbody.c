@@ -0,0 +1,134 @@
+/* n-body simulation - floating point arithmetic and struct members */
+#include <stdio.h>
+#include <math.h>
+
+#define NUM_BODIES 5
+#define STEPS 3000
+#define PI 3.141592653589793
+#define SOLAR_MASS (4 * PI * PI)
+#define DAYS_PER_YEAR 365.24
+
+struct Body
+{
+    double X;
+    double Y;
+    double Z;
+    double VX;
+    double VY;
+    double VZ;
+    double Mass;
+};
+
+struct Body Bodies[NUM_BODIES];
+
+void SetBody(int Num, double X, double Y, double Z, double VX, double VY, double VZ, double Mass)
+{
+    Bodies[Num].X = X;
+    Bodies[Num].Y = Y;
+    Bodies[Num].Z = Z;
+    Bodies[Num].VX = VX * DAYS_PER_YEAR;
+    Bodies[Num].VY = VY * DAYS_PER_YEAR;
+    Bodies[Num].VZ = VZ * DAYS_PER_YEAR;
+    Bodies[Num].Mass = Mass * SOLAR_MASS;
+}
+
+void OffsetMomentum()
+{
+    double PX = 0.0;
+    double PY = 0.0;
+    double PZ = 0.0;
+    int I;
+
+    for (I = 0; I < NUM_BODIES; I++)
+    {
+        PX += Bodies[I].VX * Bodies[I].Mass;
+        PY += Bodies[I].VY * Bodies[I].Mass;
+        PZ += Bodies[I].VZ * Bodies[I].Mass;
+    }
+
+    Bodies[0].VX = -PX / SOLAR_MASS;
+    Bodies[0].VY = -PY / SOLAR_MASS;
+    Bodies[0].VZ = -PZ / SOLAR_MASS;
+}
+
+double Energy()
+{
+    double E = 0.0;
+    double DX, DY, DZ;
+    int I;
+    int J;
+
+    for (I = 0; I < NUM_BODIES; I++)
+    {
+        E += 0.5 * Bodies[I].Mass * (Bodies[I].VX * Bodies[I].VX + Bodies[I].VY * Bodies[I].VY + Bodies[I].VZ * Bodies[I].VZ);
+        for (J = I + 1; J < NUM_BODIES; J++)
+        {
+            DX = Bodies[I].X - Bodies[J].X;
+            DY = Bodies[I].Y - Bodies[J].Y;
+            DZ = Bodies[I].Z - Bodies[J].Z;
+            E -= Bodies[I].Mass * Bodies[J].Mass / sqrt(DX * DX + DY * DY + DZ * DZ);
+        }
+    }
+
+    return E;
+}
+
+void Advance(double DT)
+{
+    struct Body *A;
+    struct Body *B;
+    double DX, DY, DZ, Dist2, Mag;
+    int I;
+    int J;
+
+    for (I = 0; I < NUM_BODIES; I++)
+    {
+        A = &Bodies[I];
+        for (J = I + 1; J < NUM_BODIES; J++)
+        {
+            B = &Bodies[J];
+            DX = A->X - B->X;
+            DY = A->Y - B->Y;
+            DZ = A->Z - B->Z;
+            Dist2 = DX * DX + DY * DY + DZ * DZ;
+            Mag = DT / (Dist2 * sqrt(Dist2));
+            A->VX -= DX * B->Mass * Mag;
+            A->VY -= DY * B->Mass * Mag;
+            A->VZ -= DZ * B->Mass * Mag;
+            B->VX += DX * A->Mass * Mag;
+            B->VY += DY * A->Mass * Mag;
+            B->VZ += DZ * A->Mass * Mag;
+        }
+    }
+
+    for (I = 0; I < NUM_BODIES; I++)
+    {
+        A = &Bodies[I];
+        A->X += DT * A->VX;
+        A->Y += DT * A->VY;
+        A->Z += DT * A->VZ;
+    }
+}
+
+int main()
+{
+    int Step;
+
+    SetBody(0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 1.0);
+    SetBody(1, 4.84143144246472090e+00, -1.16032004402742839e+00, -1.03622044471123109e-01,
+            1.66007664274403694e-03, 7.69901118419740425e-03, -6.90460016972063023e-05, 9.54791938424326609e-04);
+    SetBody(2, 8.34336671824457987e+00, 4.12479856412430479e+00, -4.03523417114321381e-01,
+            -2.76742510726862411e-03, 4.99852801234917238e-03, 2.30417297573763929e-05, 2.85885980666130812e-04);
+    SetBody(3, 1.28943695621391310e+01, -1.51111514016986312e+01, -2.23307578892655734e-01,
+            2.96460137564761618e-03, 2.37847173959480950e-03, -2.96589568540237556e-05, 4.36624404335156298e-05);
+    SetBody(4, 1.53796971148509165e+01, -2.59193146099879641e+01, 1.79258772950371181e-01,
+            2.68067772490389322e-03, 1.62824170038242295e-03, -9.51592254519715870e-05, 5.15138902046611451e-05);
+    OffsetMomentum();
+
+    printf("%.9f\n", Energy());
+    for (Step = 0; Step < STEPS; Step++)
+        Advance(0.01);
+
+    printf("%.9f\n", Energy());
+    return 0;
+}
@@ -0,0 +1,351 @@
+/* picoc lexer and parser throughput benchmark. generates large synthetic C sources -
+ * thousands of functions, long expressions and huge initialiser tables - and times
+ * LexAnalyse() on each, then parsing its tokens for definitions in skip mode, then the
+ * whole of PicocParse(), each in a fresh interpreter. the fastest of several runs is
+ * reported as tab-separated values so results can be tracked over time.
+ *
+ * build it with:   g++ -O2 -DUNIX_HOST -I. -o picoc-parsebench bench/parsebench.cpp \
+ *                      $(ls *.cpp | grep -v '^picoc.cpp$') cstdlib/[a-z]*.cpp -lm -lreadline -pthread
+ * run it with:     ./picoc-parsebench [-n <runs>] [-x <scale>] [-w <dir>] [<csource.c>...]
+ *
+ * source files named on the command line are measured instead of the synthetic ones.
+ * -w writes the synthetic sources to a directory so they can be looked at */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <chrono>
+
+#include "picoc.h"
+#include "interpreter.h"
+
+constexpr int PARSEBENCH_STACK_SIZE = 128*1024;	/* interpreter stack, as picoc itself uses */
+constexpr int PARSEBENCH_RUNS_DEFAULT = 5;		/* runs of each input, the fastest is reported */
+constexpr int PARSEBENCH_FUNCTIONS = 2000;		/* functions in the "functions" source at scale 1 */
+constexpr int PARSEBENCH_EXPRESSIONS = 200;		/* long expressions in the "expressions" source */
+constexpr int PARSEBENCH_EXPRESSION_TERMS = 200;	/* terms in each long expression */
+constexpr int PARSEBENCH_TABLES = 50;			/* initialiser tables in the "tables" source */
+constexpr int PARSEBENCH_TABLE_SIZE = 2000;		/* elements in each initialiser table */
+
+/* a growable source text */
+struct SourceBuf
+{
+	char *Text;
+	int Len;
+	int Size;
+};
+
+/* a source to measure */
+struct ParseInput
+{
+	const char *Name;
+	char *Text;
+	int Len;
+};
+
+/* how long each stage took on one input */
+struct ParseTimes
+{
+	long long LexNs;
+	long long ParseNs;
+	long long LoadNs;
+	int TokenBytes;
+};
+
+static long long ParseBenchNow()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/* add formatted text to the end of a source */
+static void SourceAppend(struct SourceBuf *Buf, const char *Format, ...)
+{
+	va_list Args;
+	int Len;
+
+	for (;;)
+	{
+		va_start(Args, Format);
+		Len = vsnprintf(Buf->Text + Buf->Len, Buf->Size - Buf->Len, Format, Args);
+		va_end(Args);
+		if (Buf->Len + Len < Buf->Size)
+			break;
+
+		Buf->Size = Buf->Size * 2 + Len + 1;
+		Buf->Text = (char *)realloc(Buf->Text, Buf->Size);
+		if (Buf->Text == nullptr)
+		{
+			fprintf(stderr, "out of memory\n");
+			exit(1);
+		}
+	}
+
+	Buf->Len += Len;
+}
+
+/* lots of small functions with the usual kinds of statement in them */
+static void GenerateFunctions(struct SourceBuf *Buf, int Scale)
+{
+	int Count;
+
+	for (Count = 0; Count < PARSEBENCH_FUNCTIONS * Scale; Count++)
+	{
+		SourceAppend(Buf,
+			"int Function%d(int A, int B)\n"
+			"{\n"
+			"    int C = A * %d + B;\n"
+			"    int D;\n"
+			"\n"
+			"    for (D = 0; D < 10; D++)\n"
+			"    {\n"
+			"        if (C > %d)\n"
+			"            C -= D;\n"
+			"        else\n"
+			"            C += A;\n"
+			"    }\n"
+			"\n"
+			"    switch (C %% 3)\n"
+			"    {\n"
+			"        case 0: return C;\n"
+			"        case 1: return C + B;\n"
+			"    }\n"
+			"\n"
+			"    return Function%d(C, D);\n"
+			"}\n"
+			"\n", Count, Count % 97, Count * 7, Count > 0 ? Count - 1 : 0);
+	}
+}
+
+/* global variables initialised by very long expressions */
+static void GenerateExpressions(struct SourceBuf *Buf, int Scale)
+{
+	static const char *Operators[] = { " + ", " - ", " * ", " / ", " % ", " << ", " & ", " | " };
+	int Count;
+	int Term;
+
+	for (Count = 0; Count < PARSEBENCH_EXPRESSIONS * Scale; Count++)
+	{
+		SourceAppend(Buf, "int Expression%d = (1", Count);
+		for (Term = 1; Term < PARSEBENCH_EXPRESSION_TERMS; Term++)
+		{
+			if (Term % 16 == 0)
+				SourceAppend(Buf, ")\n    + (%d", Term);
+			else
+				SourceAppend(Buf, "%s%d", Operators[(Count + Term) % 8], Term % 29 + 1);
+		}
+
+		SourceAppend(Buf, ");\n");
+	}
+}
+
+/* big arrays with initialisers */
+static void GenerateTables(struct SourceBuf *Buf, int Scale)
+{
+	int Count;
+	int Element;
+
+	for (Count = 0; Count < PARSEBENCH_TABLES * Scale; Count++)
+	{
+		SourceAppend(Buf, "int Table%d[%d] =\n{", Count, PARSEBENCH_TABLE_SIZE);
+		for (Element = 0; Element < PARSEBENCH_TABLE_SIZE; Element++)
+			SourceAppend(Buf, "%s%d,", Element % 16 == 0 ? "\n    " : " ", (Element * 2654435761u) % 100000);
+
+		SourceAppend(Buf, "\n};\n\n");
+	}
+}
+
+static struct ParseInput Generate(const char *Name, void (*Generator)(struct SourceBuf *, int), int Scale)
+{
+	struct SourceBuf Buf = { nullptr, 0, 0 };
+	struct ParseInput Input;
+
+	SourceAppend(&Buf, "/* synthetic %s source */\n\n", Name);
+	Generator(&Buf, Scale);
+	Input.Name = Name;
+	Input.Text = Buf.Text;
+	Input.Len = Buf.Len;
+	return Input;
+}
+
+static struct ParseInput ReadInput(const char *FileName)
+{
+	struct ParseInput Input;
+	FILE *In = fopen(FileName, "rb");
+	long Len;
+
+	if (In == nullptr || fseek(In, 0, SEEK_END) != 0 || (Len = ftell(In)) < 0)
+	{
+		fprintf(stderr, "can't read %s\n", FileName);
+		exit(1);
+	}
+
+	rewind(In);
+	Input.Name = FileName;
+	Input.Text = (char *)malloc(Len + 1);
+	Input.Len = fread(Input.Text, 1, Len, In);
+	Input.Text[Input.Len] = '\0';
+	fclose(In);
+	return Input;
+}
+
+static void WriteInput(const char *Dir, struct ParseInput *Input)
+{
+	char FileName[256];
+	FILE *Out;
+
+	snprintf(FileName, sizeof(FileName), "%s/%s.c", Dir, Input->Name);
+	Out = fopen(FileName, "wb");
+	if (Out == nullptr || fwrite(Input->Text, 1, Input->Len, Out) != (size_t)Input->Len)
+	{
+		fprintf(stderr, "can't write %s\n", FileName);
+		exit(1);
+	}
+
+	fclose(Out);
+}
+
+/* time each stage of loading an input once. returns false if it failed to load */
+static bool MeasureOnce(struct ParseInput *Input, struct ParseTimes *Times)
+{
+	Picoc pc;
+	void *Tokens;
+	long long StartNs;
+
+	/* lexing, then parsing the same tokens for definitions without running anything */
+	PicocInitialise(&pc, PARSEBENCH_STACK_SIZE);
+	if (PicocPlatformSetExitPoint(&pc))
+	{
+		PicocCleanup(&pc);
+		return false;
+	}
+
+	StartNs = ParseBenchNow();
+	Tokens = LexAnalyse(&pc, TableStrRegister(&pc, Input->Name), Input->Text, Input->Len, &Times->TokenBytes);
+	Times->LexNs = ParseBenchNow() - StartNs;
+
+	StartNs = ParseBenchNow();
+	ParseTokens(&pc, Input->Name, Input->Text, Tokens, false, false, false, false);
+	Times->ParseNs = ParseBenchNow() - StartNs;
+	PicocCleanup(&pc);
+
+	/* the whole of loading a source, as a host would do it */
+	PicocInitialise(&pc, PARSEBENCH_STACK_SIZE);
+	if (PicocPlatformSetExitPoint(&pc))
+	{
+		PicocCleanup(&pc);
+		return false;
+	}
+
+	StartNs = ParseBenchNow();
+	PicocParse(&pc, Input->Name, Input->Text, Input->Len, false, false, false, false);
+	Times->LoadNs = ParseBenchNow() - StartNs;
+	PicocCleanup(&pc);
+
+	return true;
+}
+
+static double MBPerSecond(int Bytes, long long Ns)
+{
+	return Ns > 0 ? Bytes / 1e6 / (Ns / 1e9) : 0.0;
+}
+
+/* measure an input a number of times and print its line of the report */
+static bool Measure(struct ParseInput *Input, int NumRuns)
+{
+	struct ParseTimes Best = { 0, 0, 0, 0 };
+	struct ParseTimes Times;
+	int Count;
+
+	for (Count = 0; Count < NumRuns; Count++)
+	{
+		if (!MeasureOnce(Input, &Times))
+		{
+			fprintf(stderr, "%s failed to load\n", Input->Name);
+			return false;
+		}
+
+		if (Count == 0 || Times.LexNs < Best.LexNs)
+			Best.LexNs = Times.LexNs;
+
+		if (Count == 0 || Times.ParseNs < Best.ParseNs)
+			Best.ParseNs = Times.ParseNs;
+
+		if (Count == 0 || Times.LoadNs < Best.LoadNs)
+			Best.LoadNs = Times.LoadNs;
+
+		Best.TokenBytes = Times.TokenBytes;
+	}
+
+	printf("%s\t%d\t%d\t%.3f\t%.1f\t%.3f\t%.1f\t%.3f\t%.1f\n", Input->Name, Input->Len, Best.TokenBytes,
+		Best.LexNs / 1e6, MBPerSecond(Input->Len, Best.LexNs),
+		Best.ParseNs / 1e6, MBPerSecond(Input->Len, Best.ParseNs),
+		Best.LoadNs / 1e6, MBPerSecond(Input->Len, Best.LoadNs));
+	fflush(stdout);
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+	struct ParseInput Inputs[3];
+	int NumInputs = 0;
+	int NumRuns = PARSEBENCH_RUNS_DEFAULT;
+	int Scale = 1;
+	const char *WriteDir = nullptr;
+	int Failed = 0;
+	int Opt;
+	int Count;
+
+	while ((Opt = getopt(argc, argv, "n:x:w:")) != -1)
+	{
+		switch (Opt)
+		{
+			case 'n': NumRuns = atoi(optarg); break;
+			case 'x': Scale = atoi(optarg); break;
+			case 'w': WriteDir = optarg; break;
+			default:
+				fprintf(stderr, "Format: picoc-parsebench [-n <runs>] [-x <scale>] [-w <dir>] [<csource.c>...]\n");
+				return 1;
+		}
+	}
+
+	if (NumRuns < 1 || Scale < 1)
+	{
+		fprintf(stderr, "the number of runs and the scale must be at least 1\n");
+		return 1;
+	}
+
+	printf("# lexing, parsing in skip mode and PicocParse(), fastest of %d runs\n", NumRuns);
+	printf("input\tbytes\ttoken_bytes\tlex_ms\tlex_MB_per_s\tparse_ms\tparse_MB_per_s\tload_ms\tload_MB_per_s\n");
+	if (optind < argc)
+	{
+		for (Count = optind; Count < argc; Count++)
+		{
+			struct ParseInput Input = ReadInput(argv[Count]);
+
+			if (!Measure(&Input, NumRuns))
+				Failed++;
+
+			free(Input.Text);
+		}
+
+		return Failed > 0;
+	}
+
+	Inputs[NumInputs++] = Generate("functions", GenerateFunctions, Scale);
+	Inputs[NumInputs++] = Generate("expressions", GenerateExpressions, Scale);
+	Inputs[NumInputs++] = Generate("tables", GenerateTables, Scale);
+	for (Count = 0; Count < NumInputs; Count++)
+	{
+		if (WriteDir != nullptr)
+			WriteInput(WriteDir, &Inputs[Count]);
+
+		if (!Measure(&Inputs[Count], NumRuns))
+			Failed++;
+
+		free(Inputs[Count].Text);
+	}
+
+	return Failed > 0;
+}
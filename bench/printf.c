@@ -0,0 +1,18 @@
+/* formatted output - printf of integers, strings and floating point */
+#include <stdio.h>
+
+#define LINES 100000
+
+int main()
+{
+    int Count;
+    double Value = 0.0;
+
+    for (Count = 0; Count < LINES; Count++)
+    {
+        printf("%6d %-8s %08x %c %10.3f\n", Count, "item", Count * 40503, 'a' + Count % 26, Value);
+        Value += 1.25;
+    }
+
+    return 0;
+}
@@ -0,0 +1,40 @@
+/* deep recursion - stack frame creation and teardown at depth */
+#include <stdio.h>
+
+#define DEPTH 100            /* the default interpreter stack has room for a little more than this */
+#define PASSES 1500
+
+int Sum(int N, int *Visits)
+{
+    int Local = N;
+
+    (*Visits)++;
+    if (N == 0)
+        return 0;
+
+    return Local + Sum(N - 1, Visits);
+}
+
+int Ackermann(int M, int N)
+{
+    if (M == 0)
+        return N + 1;
+
+    if (N == 0)
+        return Ackermann(M - 1, 1);
+
+    return Ackermann(M - 1, Ackermann(M, N - 1));
+}
+
+int main()
+{
+    int Pass;
+    int Total = 0;
+    int Visits = 0;
+
+    for (Pass = 0; Pass < PASSES; Pass++)
+        Total += Sum(DEPTH, &Visits);
+
+    printf("%d %d %d\n", Total, Visits, Ackermann(2, 60));
+    return 0;
+}
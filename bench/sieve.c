@@ -0,0 +1,41 @@
+/* sieve of eratosthenes - array indexing and tight loops */
+#include <stdio.h>
+
+#define SIEVE_SIZE 50000
+#define SIEVE_PASSES 2
+
+char Composite[SIEVE_SIZE + 1];
+
+int Sieve()
+{
+    int Count = 0;
+    int I;
+    int J;
+
+    for (I = 0; I <= SIEVE_SIZE; I++)
+        Composite[I] = 0;
+
+    for (I = 2; I <= SIEVE_SIZE; I++)
+    {
+        if (!Composite[I])
+        {
+            Count++;
+            for (J = I + I; J <= SIEVE_SIZE; J += I)
+                Composite[J] = 1;
+        }
+    }
+
+    return Count;
+}
+
+int main()
+{
+    int Pass;
+    int Primes = 0;
+
+    for (Pass = 0; Pass < SIEVE_PASSES; Pass++)
+        Primes = Sieve();
+
+    printf("%d\n", Primes);
+    return 0;
+}
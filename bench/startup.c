@@ -0,0 +1,5 @@
+/* does nothing - measures interpreter startup and shutdown */
+int main()
+{
+    return 0;
+}
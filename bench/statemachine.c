@@ -0,0 +1,87 @@
+/* switch-based state machine - a tokeniser counting words, numbers and symbols */
+#include <stdio.h>
+
+#define PASSES 500
+
+#define STATE_SPACE 0
+#define STATE_WORD 1
+#define STATE_NUMBER 2
+#define STATE_SYMBOL 3
+
+char *Text = "int Count = 42; while (Count > 0) { Total += Count * 3; Count--; } return Total + 7;";
+
+int Words;
+int Numbers;
+int Symbols;
+
+int CharClass(char Ch)
+{
+    if ((Ch >= 'a' && Ch <= 'z') || (Ch >= 'A' && Ch <= 'Z') || Ch == '_')
+        return STATE_WORD;
+
+    if (Ch >= '0' && Ch <= '9')
+        return STATE_NUMBER;
+
+    if (Ch == ' ')
+        return STATE_SPACE;
+
+    return STATE_SYMBOL;
+}
+
+void Scan(char *Pos)
+{
+    int State = STATE_SPACE;
+    int Class;
+
+    while (*Pos != '\0')
+    {
+        Class = CharClass(*Pos);
+        switch (State)
+        {
+            case STATE_SPACE:
+                State = Class;
+                break;
+
+            case STATE_WORD:
+                if (Class != STATE_WORD && Class != STATE_NUMBER)
+                {
+                    Words++;
+                    State = Class;
+                }
+                break;
+
+            case STATE_NUMBER:
+                if (Class != STATE_NUMBER)
+                {
+                    Numbers++;
+                    State = Class;
+                }
+                break;
+
+            case STATE_SYMBOL:
+                Symbols++;
+                State = Class;
+                break;
+        }
+
+        Pos++;
+    }
+
+    switch (State)
+    {
+        case STATE_WORD: Words++; break;
+        case STATE_NUMBER: Numbers++; break;
+        case STATE_SYMBOL: Symbols++; break;
+    }
+}
+
+int main()
+{
+    int Pass;
+
+    for (Pass = 0; Pass < PASSES; Pass++)
+        Scan(Text);
+
+    printf("%d %d %d\n", Words, Numbers, Symbols);
+    return 0;
+}
@@ -0,0 +1,49 @@
+/* string building - the string library and character loops */
+#include <stdio.h>
+#include <string.h>
+
+#define LINES 5000
+
+char Line[256];
+char Word[32];
+
+void Reverse(char *Str)
+{
+    int Start = 0;
+    int End = strlen(Str) - 1;
+    char Swap;
+
+    while (Start < End)
+    {
+        Swap = Str[Start];
+        Str[Start] = Str[End];
+        Str[End] = Swap;
+        Start++;
+        End--;
+    }
+}
+
+int main()
+{
+    int Count;
+    int Num;
+    int Total = 0;
+
+    for (Count = 0; Count < LINES; Count++)
+    {
+        strcpy(Line, "line");
+        for (Num = 0; Num < 8; Num++)
+        {
+            sprintf(Word, " %d", Count * 8 + Num);
+            strcat(Line, Word);
+        }
+
+        Reverse(Line);
+        Total += strlen(Line);
+        if (strncmp(Line, "0", 1) == 0)
+            Total++;
+    }
+
+    printf("%d %s\n", Total, Line);
+    return 0;
+}
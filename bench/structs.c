@@ -0,0 +1,67 @@
+/* struct array processing - member access through arrays and pointers */
+#include <stdio.h>
+
+#define NUM_PARTICLES 1000
+#define PASSES 80
+
+struct Particle
+{
+    int X;
+    int Y;
+    int DX;
+    int DY;
+    int Hits;
+};
+
+struct Particle Particles[NUM_PARTICLES];
+
+void Reset()
+{
+    int I;
+
+    for (I = 0; I < NUM_PARTICLES; I++)
+    {
+        Particles[I].X = (I * 37) % 640;
+        Particles[I].Y = (I * 91) % 480;
+        Particles[I].DX = I % 7 - 3;
+        Particles[I].DY = I % 5 - 2;
+        Particles[I].Hits = 0;
+    }
+}
+
+void Move(struct Particle *P)
+{
+    P->X += P->DX;
+    P->Y += P->DY;
+    if (P->X < 0 || P->X >= 640)
+    {
+        P->DX = -P->DX;
+        P->Hits++;
+    }
+
+    if (P->Y < 0 || P->Y >= 480)
+    {
+        P->DY = -P->DY;
+        P->Hits++;
+    }
+}
+
+int main()
+{
+    int Pass;
+    int I;
+    int Total = 0;
+
+    Reset();
+    for (Pass = 0; Pass < PASSES; Pass++)
+    {
+        for (I = 0; I < NUM_PARTICLES; I++)
+            Move(&Particles[I]);
+    }
+
+    for (I = 0; I < NUM_PARTICLES; I++)
+        Total += Particles[I].X + Particles[I].Y + Particles[I].Hits;
+
+    printf("%d\n", Total);
+    return 0;
+}
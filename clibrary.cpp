@@ -128,6 +128,380 @@ void PrintType(struct ValueType *Typ, IOFILE *Stream)
 }
 
 
+// pairs of decimal digits for formatting two digits at a time
+static const char DigitPairs[] =
+	"0001020304050607080910111213141516171819202122232425262728293031323334353637383940414243444546474849"
+	"5051525354555657585960616263646566676869707172737475767778798081828384858687888990919293949596979899";
+
+// powers of ten for fixed-point formatting
+static const unsigned long PowersOfTen[] =
+{
+	1UL, 10UL, 100UL, 1000UL, 10000UL, 100000UL, 1000000UL, 10000000UL, 100000000UL, 1000000000UL,
+	10000000000UL, 100000000000UL, 1000000000000UL, 10000000000000UL, 100000000000000UL,
+	1000000000000000UL, 10000000000000000UL, 100000000000000000UL
+};
+
+// format an unsigned number backwards from the end of a buffer. returns the start of the digits
+char *LibFormatUnsigned(char *BufEnd, unsigned long Num)
+{
+	char *Pos = BufEnd;
+
+	while (Num >= 100)
+	{
+		const char *Pair = &DigitPairs[(Num % 100) * 2];
+
+		Num /= 100;
+		*--Pos = Pair[1];
+		*--Pos = Pair[0];
+	}
+
+	if (Num >= 10)
+	{
+		*--Pos = DigitPairs[Num * 2 + 1];
+		*--Pos = DigitPairs[Num * 2];
+	}
+	else
+		*--Pos = '0' + Num;
+
+	return Pos;
+}
+
+// format a double like printf's "%.<Precision>f", exactly rounded. the value is split into
+// its binary integer and fraction parts and the fraction is scaled by 10^Precision in 128 bit
+// arithmetic, so there's no accumulated error. Buf needs LIB_FORMAT_FP_MAX bytes. returns the
+// length, or -1 for infinities, NaNs, very large values and precisions beyond 17 digits which
+// the caller should hand to the host's printf instead
+int LibFormatFP(char *Buf, double Num, int Precision)
+{
+#ifdef __SIZEOF_INT128__
+	unsigned long Bits;
+	unsigned long Mantissa;
+	unsigned long IntPart;
+	unsigned long FracDigits = 0;
+	int Exponent;
+	char NumBuf[24];
+	char *Pos;
+	char *BufPos = Buf;
+
+	if (Precision < 0 || Precision > 17)
+		return -1;
+
+	memcpy((void *)&Bits, (void *)&Num, sizeof(Bits));
+	Exponent = (int)((Bits >> 52) & 0x7ff);
+	Mantissa = Bits & ((1UL << 52) - 1);
+	if (Exponent == 0x7ff)
+		return -1;
+
+	if (Exponent == 0)
+		Exponent = -1074;
+	else
+	{
+		Mantissa |= 1UL << 52;
+		Exponent -= 1075;
+	}
+
+	if (Exponent >= 0)
+	{
+		// a whole number
+		if (Exponent > 10)
+			return -1;
+
+		IntPart = Mantissa << Exponent;
+	}
+	else
+	{
+		int Shift = -Exponent;
+		unsigned long FracBits = Mantissa;
+		unsigned __int128 Scaled;
+		unsigned __int128 Remainder;
+		unsigned __int128 Half;
+
+		IntPart = (Shift < 64) ? Mantissa >> Shift : 0;
+		if (Shift < 64)
+			FracBits -= IntPart << Shift;
+
+		// round the scaled fraction to nearest, ties to even
+		Scaled = (unsigned __int128)FracBits * PowersOfTen[Precision];
+		if (Shift < 128)
+		{
+			FracDigits = (unsigned long)(Scaled >> Shift);
+			Remainder = Scaled - ((unsigned __int128)FracDigits << Shift);
+			Half = (unsigned __int128)1 << (Shift - 1);
+			if (Remainder > Half || (Remainder == Half && (((Precision > 0) ? FracDigits : IntPart) & 1)))
+				FracDigits++;
+
+			if (FracDigits == PowersOfTen[Precision])
+			{
+				FracDigits = 0;
+				IntPart++;
+			}
+		}
+	}
+
+	if (Bits >> 63)
+		*BufPos++ = '-';
+
+	Pos = LibFormatUnsigned(&NumBuf[sizeof(NumBuf)], IntPart);
+	memcpy((void *)BufPos, (void *)Pos, &NumBuf[sizeof(NumBuf)] - Pos);
+	BufPos += &NumBuf[sizeof(NumBuf)] - Pos;
+
+	if (Precision > 0)
+	{
+		*BufPos++ = '.';
+		Pos = LibFormatUnsigned(&NumBuf[sizeof(NumBuf)], FracDigits);
+		memset((void *)BufPos, '0', Precision - (&NumBuf[sizeof(NumBuf)] - Pos));
+		BufPos += Precision - (&NumBuf[sizeof(NumBuf)] - Pos);
+		memcpy((void *)BufPos, (void *)Pos, &NumBuf[sizeof(NumBuf)] - Pos);
+		BufPos += &NumBuf[sizeof(NumBuf)] - Pos;
+	}
+
+	return BufPos - Buf;
+#else
+	return -1;
+#endif
+}
+
+/* exact powers of ten for the fast floating point parsing path */
+static const double ExactPowersOfTen[] =
+{
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+/* check if eight characters loaded little-endian are all decimal digits */
+static int LibIsEightDigits(unsigned long long Chunk)
+{
+	return ((Chunk & 0xf0f0f0f0f0f0f0f0ULL) | (((Chunk + 0x0606060606060606ULL) & 0xf0f0f0f0f0f0f0f0ULL) >> 4)) == 0x3333333333333333ULL;
+}
+
+/* convert eight digit characters loaded little-endian to their value, combining them in pairs */
+static unsigned long LibEightDigitsValue(unsigned long long Chunk)
+{
+	Chunk -= 0x3030303030303030ULL;
+	Chunk = (Chunk * 10) + (Chunk >> 8);
+	Chunk = (((Chunk & 0x000000ff000000ffULL) * 0x000f424000000064ULL) + (((Chunk >> 16) & 0x000000ff000000ffULL) * 0x0000271000000001ULL)) >> 32;
+	return (unsigned long)Chunk;
+}
+#endif
+
+/* parse decimal digits from Pos up to End, eight at a time where possible. the value wraps
+ * if it overflows. returns the position after the digits */
+const char *LibParseDecimal(const char *Pos, const char *End, unsigned long *Num)
+{
+	unsigned long Result = 0;
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	while (End - Pos >= 8)
+	{
+		unsigned long long Chunk;
+
+		memcpy((void *)&Chunk, (void *)Pos, sizeof(Chunk));
+		if (!LibIsEightDigits(Chunk))
+			break;
+
+		Result = Result * 100000000UL + LibEightDigitsValue(Chunk);
+		Pos += 8;
+	}
+#endif
+
+	for (; Pos < End && *Pos >= '0' && *Pos <= '9'; Pos++)
+		Result = Result * 10 + (*Pos - '0');
+
+	*Num = Result;
+	return Pos;
+}
+
+/* parse a decimal floating point number from Str up to End in the form accepted by strtod().
+ * EndPtr is set to the end of the number, or to Str if there isn't one. returns false if the
+ * result can't be found exactly with one double multiply or divide, which is left to the
+ * caller. this covers up to 15 significant digits with exponents up to 22, and more besides */
+static int LibParseFPFast(const char *Str, const char *End, double *Result, const char **EndPtr)
+{
+	const char *Pos = Str;
+	unsigned long long Mantissa = 0;
+	int MantissaDigits = 0;
+	int Exponent = 0;
+	int ExpValue = 0;
+	int Negative = false;
+	int AnyDigits = false;
+	int Truncated = false;
+
+	*EndPtr = Str;
+	if (Pos < End && (*Pos == '+' || *Pos == '-'))
+		Negative = *Pos++ == '-';
+
+	/* hex floats are left to the host */
+	if (End - Pos >= 2 && Pos[0] == '0' && (Pos[1] == 'x' || Pos[1] == 'X'))
+		return false;
+
+	for (; Pos < End && *Pos >= '0' && *Pos <= '9'; Pos++)
+	{
+		AnyDigits = true;
+		if (MantissaDigits < 19)
+		{
+			Mantissa = Mantissa * 10 + (*Pos - '0');
+			MantissaDigits += Mantissa != 0;
+		}
+		else
+		{
+			Exponent++;
+			Truncated |= *Pos != '0';
+		}
+	}
+
+	if (Pos < End && *Pos == '.')
+	{
+		for (Pos++; Pos < End && *Pos >= '0' && *Pos <= '9'; Pos++)
+		{
+			AnyDigits = true;
+			if (MantissaDigits < 19)
+			{
+				Mantissa = Mantissa * 10 + (*Pos - '0');
+				MantissaDigits += Mantissa != 0;
+				Exponent--;
+			}
+			else
+				Truncated |= *Pos != '0';
+		}
+	}
+
+	if (!AnyDigits)
+		return false;
+
+	/* only take the exponent if it has some digits */
+	if (Pos < End && (*Pos == 'e' || *Pos == 'E'))
+	{
+		const char *ExpPos = Pos + 1;
+		int ExpNegative = false;
+
+		if (ExpPos < End && (*ExpPos == '+' || *ExpPos == '-'))
+			ExpNegative = *ExpPos++ == '-';
+
+		if (ExpPos < End && *ExpPos >= '0' && *ExpPos <= '9')
+		{
+			for (Pos = ExpPos; Pos < End && *Pos >= '0' && *Pos <= '9'; Pos++)
+			{
+				if (ExpValue < 100000)
+					ExpValue = ExpValue * 10 + (*Pos - '0');
+			}
+
+			Exponent += ExpNegative ? -ExpValue : ExpValue;
+		}
+	}
+
+	*EndPtr = Pos;
+	if (Mantissa == 0 && !Truncated)
+	{
+		*Result = Negative ? -0.0 : 0.0;
+		return true;
+	}
+
+	if (Truncated || Mantissa > (1ULL << 53))
+		return false;
+
+	/* a large exponent can be partly absorbed by the mantissa if it stays exact */
+	for (; Exponent > 22 && Mantissa * 10 <= (1ULL << 53); Exponent--)
+		Mantissa *= 10;
+
+	if (Exponent > 22 || Exponent < -22)
+		return false;
+
+	if (Exponent >= 0)
+		*Result = (double)Mantissa * ExactPowersOfTen[Exponent];
+	else
+		*Result = (double)Mantissa / ExactPowersOfTen[-Exponent];
+
+	if (Negative)
+		*Result = -*Result;
+
+	return true;
+}
+
+/* parse a decimal floating point number from Str up to End, which needn't be terminated.
+ * EndPtr is set to the end of the number. for a decimal literal the result is exactly what
+ * strtod() would give. hex floats, infinities and NaNs aren't recognised: they give 0.0
+ * with EndPtr set to Str */
+double LibParseFP(const char *Str, const char *End, const char **EndPtr)
+{
+	char NumBuf[LIB_PARSE_MAX];
+	char *CopyBuf = &NumBuf[0];
+	double Result;
+
+	if (LibParseFPFast(Str, End, &Result, EndPtr))
+		return Result;
+
+	if (*EndPtr == Str)
+		return 0.0;
+
+	/* hand a terminated copy to the host */
+	if (*EndPtr - Str >= LIB_PARSE_MAX)
+	{
+		CopyBuf = (char *)malloc(*EndPtr - Str + 1);
+		if (CopyBuf == nullptr)
+			return 0.0;
+	}
+
+	memcpy((void *)CopyBuf, (void *)Str, *EndPtr - Str);
+	CopyBuf[*EndPtr - Str] = '\0';
+	Result = strtod(CopyBuf, nullptr);
+	if (CopyBuf != &NumBuf[0])
+		free(CopyBuf);
+
+	return Result;
+}
+
+/* strtod() for terminated strings, trying the fast path first */
+double LibStrToFP(const char *Str, char **EndPtr)
+{
+	const char *Pos = Str;
+	const char *NumEnd;
+	double Result;
+
+	while (isspace((unsigned char)*Pos))
+		Pos++;
+
+	/* only look a bounded distance ahead so long strings aren't scanned for their end */
+	if (memchr((void *)Pos, '\0', LIB_PARSE_MAX) != nullptr && LibParseFPFast(Pos, Pos + strlen(Pos), &Result, &NumEnd))
+	{
+		if (EndPtr != nullptr)
+			*EndPtr = (char *)NumEnd;
+
+		return Result;
+	}
+
+	return strtod(Str, EndPtr);
+}
+
+/* strtol() with base 10 for terminated strings, trying the fast path first */
+long LibStrToLong(const char *Str, char **EndPtr)
+{
+	const char *Pos = Str;
+	const char *DigitStart;
+	unsigned long Num;
+	int Negative = false;
+
+	while (isspace((unsigned char)*Pos))
+		Pos++;
+
+	if (*Pos == '+' || *Pos == '-')
+		Negative = *Pos++ == '-';
+
+	/* anything which could overflow goes to the host so it's clamped in the same way */
+	DigitStart = Pos;
+	if (memchr((void *)Pos, '\0', LIB_PARSE_MAX) == nullptr)
+		return strtol(Str, EndPtr, 10);
+
+	Pos = LibParseDecimal(Pos, Pos + strlen(Pos), &Num);
+	if (Pos == DigitStart || Pos - DigitStart > ((sizeof(long) >= 8) ? 18 : 9))
+		return strtol(Str, EndPtr, 10);
+
+	if (EndPtr != nullptr)
+		*EndPtr = (char *)Pos;
+
+	return Negative ? -(long)Num : (long)Num;
+}
+
 /* This is a simplified standard library for small embedded systems. It doesn't require
  * a system stdio library to operate.
  *
@@ -4,6 +4,8 @@
 #include "../interpreter.h"
 
 #define MAX_FORMAT 80
+#define MAX_CONVERSION 128      /* most conversions fit in this without needing an allocation */
+#define MAX_FAST_WIDTH 100      /* wider conversions than this go to the host's printf */
 #define MAX_SCANF_ARGS 10
 
 static int Stdio_ZeroValue = 0;
@@ -24,9 +26,10 @@ static FILE *stdoutValue;
 static FILE *stderrValue;
 
 
-/* our own internal output stream which can output to FILE * or strings */
+/* our own internal output stream which can output to the interpreter's output buffer, FILE * or strings */
 typedef struct StdOutStreamStruct
 {
+    IOFILE *OutBuf;
     FILE *FilePtr;
     char *StrOutPtr;
     int StrOutLen;
@@ -34,6 +37,35 @@ typedef struct StdOutStreamStruct
 
 } StdOutStream;
 
+/* kinds of piece in a parsed printf format */
+enum StdioDirectiveKind
+{
+    StdioDirectiveEnd,
+    StdioDirectiveText,         /* literal text, including "%%" */
+    StdioDirectiveErrno,        /* %m */
+    StdioDirectiveCount,        /* %n */
+    StdioDirectiveInt,
+    StdioDirectiveFP,
+    StdioDirectiveString,
+    StdioDirectivePointer,
+    StdioDirectiveNone          /* a conversion with no conversion character */
+};
+
+/* one piece of a parsed printf format */
+struct StdioFormatDirective
+{
+    enum StdioDirectiveKind Kind;
+    const char *Text;           /* the literal text or a null-terminated copy of the conversion spec */
+    int Len;
+    char Conversion;
+    char LengthMod;             /* 'h', 'H' for "hh", 'l' or 0 */
+    char LeftJustify;
+    char ZeroPad;
+    char Fast;                  /* true if we can format it ourselves rather than using the host's printf */
+    short Width;
+    short Precision;            /* -1 if there isn't one */
+};
+
 /* our representation of varargs within picoc */
 struct StdVararg
 {
@@ -44,17 +76,33 @@ struct StdVararg
 /* initialises the I/O system so error reporting works */
 void BasicIOInit(Picoc *pc)
 {
-	//FIXME
-	pc->CStdOut = (IOFILE*)stdout;
+	pc->CStdOutBase.Sink = &PlatformStdoutSink;
+	pc->CStdOutBase.SinkContext = nullptr;
+	pc->CStdOutBase.Policy = isatty(fileno(stdout)) ? OutputFlushLine : OutputFlushFull;
+	pc->CStdOut = &pc->CStdOutBase;
+	TableInitTable(&pc->PrintfFormatTable, &pc->PrintfFormatHashTable[0], PRINTF_FORMAT_TABLE_SIZE, true);
 	stdinValue = stdin;
 	stdoutValue = stdout;
 	stderrValue = stderr;
 }
 
-/* output a single character to either a FILE * or a string */
+/* flushes output and frees the printf format cache */
+void BasicIOCleanup(Picoc *pc)
+{
+	PlatformFlush(pc->CStdOut);
+	VariableTableCleanup(pc, &pc->PrintfFormatTable);
+}
+
+/* output a single character to the output buffer, a FILE * or a string */
 void StdioOutPutc(int OutCh, StdOutStream *Stream)
 {
-    if (Stream->FilePtr != nullptr)
+    if (Stream->OutBuf != nullptr)
+    {
+        /* output to the interpreter's output buffer */
+        PrintCh(OutCh, Stream->OutBuf);
+        Stream->CharCount++;
+    }
+    else if (Stream->FilePtr != nullptr)
     {
         /* output to stdio stream */
         putc(OutCh, Stream->FilePtr);
@@ -73,39 +121,85 @@ void StdioOutPutc(int OutCh, StdOutStream *Stream)
     }
 }
 
-/* output a string to either a FILE * or a string */
+/* output a run of characters to the output buffer, a FILE * or a string */
+void StdioOutWrite(const char *Str, int Len, StdOutStream *Stream)
+{
+    if (Stream->OutBuf != nullptr)
+    {
+        /* output to the interpreter's output buffer */
+        PlatformWrite(Stream->OutBuf, Str, Len);
+        Stream->CharCount += Len;
+    }
+    else if (Stream->FilePtr != nullptr)
+    {
+        /* output to stdio stream */
+        Stream->CharCount += fwrite(Str, 1, Len, Stream->FilePtr);
+    }
+    else
+    {
+        /* output to a string, leaving room for the terminator. like snprintf() the
+         * count includes anything which didn't fit */
+        int CCount = Len;
+
+        if (Stream->StrOutLen >= 0 && CCount > Stream->StrOutLen - 1)
+            CCount = (Stream->StrOutLen > 1) ? Stream->StrOutLen - 1 : 0;
+
+        memcpy((void *)Stream->StrOutPtr, (void *)Str, CCount);
+        Stream->StrOutPtr += CCount;
+        if (Stream->StrOutLen > 1)
+            Stream->StrOutLen -= CCount;
+
+        Stream->CharCount += Len;
+    }
+}
+
+/* output a string to the output buffer, a FILE * or a string */
 void StdioOutPuts(const char *Str, StdOutStream *Stream)
 {
-	if (Stream->FilePtr != nullptr)
-	{
-		/* output to stdio stream */
-		fputs(Str, Stream->FilePtr);
-	}
-	else
-	{
-		/* output to a string */
-		while (*Str != '\0')
-		{
-			if (Stream->StrOutLen < 0 || Stream->StrOutLen > 1)
-			{
-				/* output to a string */
-				*Stream->StrOutPtr = *Str;
-				Str++;
-				Stream->StrOutPtr++;
-
-				if (Stream->StrOutLen > 1)
-					Stream->StrOutLen--;
-
-				Stream->CharCount++;
-			}
-		}
-	}
+    StdioOutWrite(Str, strlen(Str), Stream);
+}
+
+/* printf-style format into the interpreter's output buffer */
+void StdioOutBufPrintf(StdOutStream *Stream, const char *Format, ...)
+{
+    char ConversionBuf[MAX_CONVERSION];
+    char *Out = &ConversionBuf[0];
+    va_list Args;
+    int CCount;
+
+    va_start(Args, Format);
+    CCount = vsnprintf(Out, sizeof(ConversionBuf), Format, Args);
+    va_end(Args);
+
+    if (CCount >= (int)sizeof(ConversionBuf))
+    {
+        /* too long for the local buffer */
+        Out = (char *)malloc(CCount + 1);
+        if (Out == nullptr)
+            return;
+
+        va_start(Args, Format);
+        vsnprintf(Out, CCount + 1, Format, Args);
+        va_end(Args);
+    }
+
+    if (CCount > 0)
+    {
+        PlatformWrite(Stream->OutBuf, Out, CCount);
+        Stream->CharCount += CCount;
+    }
+
+    if (Out != &ConversionBuf[0])
+        free(Out);
 }
 
 /* printf-style format of an int or other word-sized object */
 void StdioFprintfWord(StdOutStream *Stream, const char *Format, unsigned long Value)
 {
-    if (Stream->FilePtr != nullptr)
+    if (Stream->OutBuf != nullptr)
+        StdioOutBufPrintf(Stream, Format, Value);
+
+    else if (Stream->FilePtr != nullptr)
         Stream->CharCount += fprintf(Stream->FilePtr, Format, Value);
 
     else if (Stream->StrOutLen >= 0)
@@ -130,7 +224,10 @@ void StdioFprintfWord(StdOutStream *Stream, const char *Format, unsigned long Va
 /* printf-style format of a floating point number */
 void StdioFprintfFP(StdOutStream *Stream, const char *Format, double Value)
 {
-    if (Stream->FilePtr != nullptr)
+    if (Stream->OutBuf != nullptr)
+        StdioOutBufPrintf(Stream, Format, Value);
+
+    else if (Stream->FilePtr != nullptr)
         Stream->CharCount += fprintf(Stream->FilePtr, Format, Value);
 
     else if (Stream->StrOutLen >= 0)
@@ -155,7 +252,10 @@ void StdioFprintfFP(StdOutStream *Stream, const char *Format, double Value)
 /* printf-style format of a pointer */
 void StdioFprintfPointer(StdOutStream *Stream, const char *Format, void *Value)
 {
-    if (Stream->FilePtr != nullptr)
+    if (Stream->OutBuf != nullptr)
+        StdioOutBufPrintf(Stream, Format, Value);
+
+    else if (Stream->FilePtr != nullptr)
         Stream->CharCount += fprintf(Stream->FilePtr, Format, Value);
 
     else if (Stream->StrOutLen >= 0)
@@ -177,37 +277,111 @@ void StdioFprintfPointer(StdOutStream *Stream, const char *Format, void *Value)
     }
 }
 
-/* internal do-anything v[s][n]printf() formatting system with output to strings or FILE * */
-int StdioBasePrintf(struct ParseState *Parser, FILE *Stream, char *StrOut, int StrOutLen, char *Format, struct StdVararg *Args)
+/* output Count copies of a padding character */
+void StdioOutPad(char PadCh, int Count, StdOutStream *Stream)
 {
-    struct Value *ThisArg = Args->Param[0];
-    int ArgCount = 0;
-    char *FPos;
-    char OneFormatBuf[MAX_FORMAT+1];
-    int OneFormatCount;
-    struct ValueType *ShowType;
-    StdOutStream SOStream;
-    Picoc *pc = Parser->pc;
+    static const char Spaces[] = "                ";
+    static const char Zeros[] = "0000000000000000";
+    const char *Pad = (PadCh == '0') ? Zeros : Spaces;
 
-    if (Format == nullptr)
-        Format = (char*)"[null format]\n";
+    while (Count > 0)
+    {
+        int ThisCount = min(Count, (int)sizeof(Spaces) - 1);
 
-    FPos = Format;
-    SOStream.FilePtr = Stream;
-    SOStream.StrOutPtr = StrOut;
-    SOStream.StrOutLen = StrOutLen;
-    SOStream.CharCount = 0;
+        StdioOutWrite(Pad, ThisCount, Stream);
+        Count -= ThisCount;
+    }
+}
+
+/* work out if a conversion spec is simple enough for our own formatters. Spec is the part
+ * between the '%' and the conversion character */
+void StdioFormatParseSpec(struct StdioFormatDirective *Directive, const char *Spec, int SpecLen)
+{
+    const char *SPos = Spec;
+    const char *SEnd = Spec + SpecLen;
+
+    Directive->Width = 0;
+    Directive->Precision = -1;
+
+    /* flags */
+    for (; SPos < SEnd && (*SPos == '-' || *SPos == '0'); SPos++)
+    {
+        if (*SPos == '-')
+            Directive->LeftJustify = true;
+        else
+            Directive->ZeroPad = true;
+    }
+
+    /* width and precision */
+    for (; SPos < SEnd && isdigit((unsigned char)*SPos) && Directive->Width <= MAX_FAST_WIDTH; SPos++)
+        Directive->Width = Directive->Width * 10 + (*SPos - '0');
+
+    if (SPos < SEnd && *SPos == '.')
+    {
+        Directive->Precision = 0;
+        for (SPos++; SPos < SEnd && isdigit((unsigned char)*SPos) && Directive->Precision <= MAX_FAST_WIDTH; SPos++)
+            Directive->Precision = Directive->Precision * 10 + (*SPos - '0');
+    }
+
+    /* length modifiers - 'H' stands for "hh" */
+    if (SPos < SEnd && *SPos == 'h')
+    {
+        Directive->LengthMod = 'h';
+        SPos++;
+        if (SPos < SEnd && *SPos == 'h')
+        {
+            Directive->LengthMod = 'H';
+            SPos++;
+        }
+    }
+    else
+    {
+        for (; SPos < SEnd && *SPos == 'l'; SPos++)
+            Directive->LengthMod = 'l';
+    }
+
+    /* anything left over, or anything too wide, goes to the host's printf */
+    Directive->Fast = SPos == SEnd && Directive->Width <= MAX_FAST_WIDTH && Directive->Precision <= MAX_FAST_WIDTH;
+    switch (Directive->Conversion)
+    {
+        case 'd': case 'i': case 'u': case 'o': case 'x': case 'X': break;
+        case 'c': case 's': Directive->Fast &= !Directive->ZeroPad; break;
+        case 'f': Directive->Fast &= Directive->LengthMod == '\0' || Directive->LengthMod == 'l'; break;
+        default: Directive->Fast = false; break;
+    }
+}
+
+/* parse a printf format into directives. with Directive == nullptr it only counts them
+ * and the pool space needed for the conversion specs. returns the number of directives
+ * including the terminating StdioDirectiveEnd */
+int StdioFormatParse(Picoc *pc, const char *Format, struct StdioFormatDirective *Directive, char *Pool, int *PoolSize)
+{
+    const char *FPos = Format;
+    int NumDirectives = 0;
+    int PoolUsed = 0;
 
     while (*FPos != '\0')
     {
-        if (*FPos == '%')
+        struct StdioFormatDirective ThisDirective;
+        const char *SpecStart = FPos;
+        struct ValueType *ShowType = nullptr;
+        int SpecLen = 1;
+
+        memset((void *)&ThisDirective, '\0', sizeof(ThisDirective));
+        if (*FPos != '%')
+        {
+            /* a run of normal characters */
+            while (*FPos != '%' && *FPos != '\0')
+                FPos++;
+
+            ThisDirective.Kind = StdioDirectiveText;
+            ThisDirective.Text = SpecStart;
+            ThisDirective.Len = FPos - SpecStart;
+        }
+        else
         {
             /* work out what type we're printing */
             FPos++;
-            ShowType = nullptr;
-            OneFormatBuf[0] = '%';
-            OneFormatCount = 1;
-
             do
             {
                 switch (*FPos)
@@ -229,94 +403,352 @@ int StdioBasePrintf(struct ParseState *Parser, FILE *Stream, char *StrOut, int S
                     case '\0':              ShowType = &pc->VoidType; break;    /* end of format string */
                 }
 
-                /* copy one character of format across to the OneFormatBuf */
-                OneFormatBuf[OneFormatCount] = *FPos;
-                OneFormatCount++;
+                ThisDirective.Conversion = *FPos;
+                SpecLen++;
+                if (*FPos != '\0')
+                    FPos++;
+
+            } while (ShowType == nullptr && SpecLen < MAX_FORMAT);
 
-                /* do special actions depending on the conversion type */
-                if (ShowType == &pc->VoidType)
+            if (ShowType == &pc->VoidType)
+            {
+                switch (ThisDirective.Conversion)
+                {
+                    case 'm':   ThisDirective.Kind = StdioDirectiveErrno; break;
+                    case 'n':   ThisDirective.Kind = StdioDirectiveCount; break;
+                    case '%':   ThisDirective.Kind = StdioDirectiveText; ThisDirective.Text = FPos-1; ThisDirective.Len = 1; break;
+                    case '\0':  continue;
+                }
+            }
+            else
+            {
+                /* keep a null-terminated copy of the spec for the host's printf */
+                if (Directive != nullptr)
                 {
-                    switch (*FPos)
-                    {
-                        case 'm':   StdioOutPuts(strerror(errno), &SOStream); break;
-                        case '%':   StdioOutPutc(*FPos, &SOStream); break;
-                        case '\0':  OneFormatBuf[OneFormatCount] = '\0'; StdioOutPutc(*FPos, &SOStream); break;
-                        case 'n':
-                            ThisArg = (struct Value *)((char *)ThisArg + MEM_ALIGN(sizeof(struct Value) + TypeStackSizeValue(ThisArg)));
-                            if (ThisArg->Typ->Base == TypeArray && ThisArg->Typ->FromType->Base == TypeInt)
-                                *(int *)ThisArg->Val->Pointer = SOStream.CharCount;
-                            break;
-                    }
+                    memcpy((void *)&Pool[PoolUsed], (void *)SpecStart, SpecLen);
+                    Pool[PoolUsed + SpecLen] = '\0';
+                    ThisDirective.Text = &Pool[PoolUsed];
+                    ThisDirective.Len = SpecLen;
                 }
 
-                FPos++;
+                PoolUsed += SpecLen + 1;
+                if (ShowType == &pc->IntType)
+                    ThisDirective.Kind = StdioDirectiveInt;
+                else if (ShowType == &pc->FPType)
+                    ThisDirective.Kind = StdioDirectiveFP;
+                else if (ShowType == pc->CharPtrType)
+                    ThisDirective.Kind = StdioDirectiveString;
+                else if (ShowType == pc->VoidPtrType)
+                    ThisDirective.Kind = StdioDirectivePointer;
+                else
+                    ThisDirective.Kind = StdioDirectiveNone;    /* unterminated spec - it still uses up an argument */
+
+                if (ShowType != nullptr)
+                    StdioFormatParseSpec(&ThisDirective, SpecStart + 1, SpecLen - 2);
+            }
+        }
+
+        if (Directive != nullptr)
+            Directive[NumDirectives] = ThisDirective;
+
+        NumDirectives++;
+    }
 
-            } while (ShowType == nullptr && OneFormatCount < MAX_FORMAT);
+    if (Directive != nullptr)
+    {
+        memset((void *)&Directive[NumDirectives], '\0', sizeof(struct StdioFormatDirective));
+        Directive[NumDirectives].Kind = StdioDirectiveEnd;
+    }
+
+    *PoolSize = PoolUsed;
+    return NumDirectives + 1;
+}
 
-            if (ShowType != &pc->VoidType)
+/* get the parsed form of a format. string literals are parsed once and cached by address,
+ * anything else is parsed into a temporary value which the caller frees */
+struct Value *StdioFormatGet(struct ParseState *Parser, const char *Format, int *IsTemporary)
+{
+    Picoc *pc = Parser->pc;
+    struct Value *FormatValue = nullptr;
+    struct StdioFormatDirective *Directive;
+    int NumDirectives;
+    int PoolSize;
+
+    if (TableGet(&pc->PrintfFormatTable, Format, &FormatValue, nullptr, nullptr, nullptr))
+    {
+        *IsTemporary = false;
+        return FormatValue;
+    }
+
+    *IsTemporary = VariableStringLiteralGet(pc, (char *)Format) == nullptr;
+    NumDirectives = StdioFormatParse(pc, Format, nullptr, nullptr, &PoolSize);
+    FormatValue = VariableAllocValueAndData(pc, Parser, sizeof(struct StdioFormatDirective) * NumDirectives + PoolSize, false, nullptr, true);
+    FormatValue->Typ = &pc->VoidType;
+    Directive = (struct StdioFormatDirective *)FormatValue->Val;
+    StdioFormatParse(pc, Format, Directive, (char *)&Directive[NumDirectives], &PoolSize);
+
+    if (!*IsTemporary)
+        TableSet(pc, &pc->PrintfFormatTable, (char *)Format, FormatValue, nullptr, 0, 0);
+
+    return FormatValue;
+}
+
+/* format an integer conversion ourselves */
+void StdioFormatInt(StdOutStream *Stream, struct StdioFormatDirective *Directive, unsigned long Value)
+{
+    char NumBuf[MAX_CONVERSION * 2];
+    char *End = &NumBuf[MAX_CONVERSION];
+    char *Pos = End;
+    const char *Digits = (Directive->Conversion == 'X') ? "0123456789ABCDEF" : "0123456789abcdef";
+    unsigned long Num;
+    unsigned Base = 10;
+    int Negative = false;
+    int ZeroLen;
+    int PadLen;
+
+    switch (Directive->Conversion)
+    {
+        case 'd': case 'i':
+        {
+            long Signed;
+
+            switch (Directive->LengthMod)
+            {
+                case 'l': Signed = (long)Value; break;
+                case 'h': Signed = (short)Value; break;
+                case 'H': Signed = (signed char)Value; break;
+                default:  Signed = (int)Value; break;
+            }
+
+            Negative = Signed < 0;
+            Num = Negative ? 0UL - (unsigned long)Signed : (unsigned long)Signed;
+            break;
+        }
+
+        default:
+            switch (Directive->LengthMod)
             {
-                if (ArgCount >= Args->NumArgs)
+                case 'l': Num = Value; break;
+                case 'h': Num = (unsigned short)Value; break;
+                case 'H': Num = (unsigned char)Value; break;
+                default:  Num = (unsigned int)Value; break;
+            }
+
+            if (Directive->Conversion == 'o')
+                Base = 8;
+            else if (Directive->Conversion == 'x' || Directive->Conversion == 'X')
+                Base = 16;
+            break;
+    }
+
+    if (Directive->Conversion == 'c')
+        *--Pos = (char)Value;
+
+    else if (Num != 0 || Directive->Precision != 0)
+    {
+        if (Base == 10)
+            Pos = LibFormatUnsigned(Pos, Num);
+        else
+        {
+            unsigned Shift = (Base == 8) ? 3 : 4;
+
+            do
+            {
+                *--Pos = Digits[Num & (Base - 1)];
+                Num >>= Shift;
+            } while (Num != 0);
+        }
+    }
+
+    /* precision gives a minimum number of digits and a '0' flag pads the width with zeros */
+    ZeroLen = (Directive->Precision > End - Pos && Directive->Conversion != 'c') ? Directive->Precision - (End - Pos) : 0;
+    PadLen = Directive->Width - (ZeroLen + (End - Pos) + Negative);
+    if (Directive->ZeroPad && !Directive->LeftJustify && Directive->Precision < 0 && PadLen > 0)
+    {
+        ZeroLen += PadLen;
+        PadLen = 0;
+    }
+
+    while (ZeroLen-- > 0)
+        *--Pos = '0';
+
+    if (Negative)
+        *--Pos = '-';
+
+    for (; PadLen > 0 && !Directive->LeftJustify; PadLen--)
+        *--Pos = ' ';
+
+    for (; PadLen > 0; PadLen--)
+        *End++ = ' ';
+
+    StdioOutWrite(Pos, End - Pos, Stream);
+}
+
+#ifndef NO_FP
+/* format a %f conversion ourselves. returns false if it's out of range for LibFormatFP() */
+int StdioFormatFP(StdOutStream *Stream, struct StdioFormatDirective *Directive, double Value)
+{
+    char NumBuf[LIB_FORMAT_FP_MAX];
+    int Len = LibFormatFP(&NumBuf[0], Value, (Directive->Precision >= 0) ? Directive->Precision : 6);
+    int Negative = NumBuf[0] == '-';
+    int PadLen = Directive->Width - Len;
+
+    if (Len < 0)
+        return false;
+
+    if (Directive->LeftJustify)
+    {
+        StdioOutWrite(&NumBuf[0], Len, Stream);
+        StdioOutPad(' ', PadLen, Stream);
+    }
+    else if (Directive->ZeroPad)
+    {
+        /* zeros go between the sign and the digits */
+        StdioOutWrite(&NumBuf[0], Negative, Stream);
+        StdioOutPad('0', PadLen, Stream);
+        StdioOutWrite(&NumBuf[Negative], Len - Negative, Stream);
+    }
+    else
+    {
+        StdioOutPad(' ', PadLen, Stream);
+        StdioOutWrite(&NumBuf[0], Len, Stream);
+    }
+
+    return true;
+}
+#endif
+
+/* format a string conversion ourselves */
+void StdioFormatStr(StdOutStream *Stream, struct StdioFormatDirective *Directive, const char *Str)
+{
+    int Len = (Directive->Precision >= 0) ? strnlen(Str, Directive->Precision) : strlen(Str);
+    int PadLen = Directive->Width - Len;
+
+    if (!Directive->LeftJustify)
+        StdioOutPad(' ', PadLen, Stream);
+
+    StdioOutWrite(Str, Len, Stream);
+
+    if (Directive->LeftJustify)
+        StdioOutPad(' ', PadLen, Stream);
+}
+
+/* internal do-anything v[s][n]printf() formatting system with output to strings or FILE *.
+ * output to stdout goes through the interpreter's output buffer */
+int StdioBasePrintf(struct ParseState *Parser, FILE *Stream, char *StrOut, int StrOutLen, char *Format, struct StdVararg *Args)
+{
+    struct Value *ThisArg = Args->Param[0];
+    int ArgCount = 0;
+    struct Value *FormatValue;
+    struct StdioFormatDirective *Directive;
+    int IsTemporary;
+    StdOutStream SOStream;
+    Picoc *pc = Parser->pc;
+
+    if (Format == nullptr)
+        Format = (char*)"[null format]\n";
+
+    SOStream.OutBuf = (Stream == stdout) ? pc->CStdOut : nullptr;
+    SOStream.FilePtr = (Stream == stdout) ? nullptr : Stream;
+    SOStream.StrOutPtr = StrOut;
+    SOStream.StrOutLen = StrOutLen;
+    SOStream.CharCount = 0;
+
+    FormatValue = StdioFormatGet(Parser, Format, &IsTemporary);
+    for (Directive = (struct StdioFormatDirective *)FormatValue->Val; Directive->Kind != StdioDirectiveEnd; Directive++)
+    {
+        switch (Directive->Kind)
+        {
+            case StdioDirectiveText:
+                StdioOutWrite(Directive->Text, Directive->Len, &SOStream);
+                continue;
+
+            case StdioDirectiveErrno:
+                StdioOutPuts(strerror(errno), &SOStream);
+                continue;
+
+            case StdioDirectiveCount:
+                ThisArg = (struct Value *)((char *)ThisArg + MEM_ALIGN(sizeof(struct Value) + TypeStackSizeValue(ThisArg)));
+                if (ThisArg->Typ->Base == TypeArray && ThisArg->Typ->FromType->Base == TypeInt)
+                    *(int *)ThisArg->Val->Pointer = SOStream.CharCount;
+                continue;
+
+            default:
+                break;
+        }
+
+        if (ArgCount >= Args->NumArgs)
+        {
+            StdioOutPuts("XXX", &SOStream);
+            continue;
+        }
+
+        /* print this argument */
+        ThisArg = (struct Value *)((char *)ThisArg + MEM_ALIGN(sizeof(struct Value) + TypeStackSizeValue(ThisArg)));
+        switch (Directive->Kind)
+        {
+            case StdioDirectiveInt:
+                /* show a signed integer */
+                if (!IS_NUMERIC_COERCIBLE(ThisArg))
                     StdioOutPuts("XXX", &SOStream);
+                else if (Directive->Fast)
+                    StdioFormatInt(&SOStream, Directive, ExpressionCoerceUnsignedInteger(ThisArg));
                 else
-                {
-                    /* null-terminate the buffer */
-                    OneFormatBuf[OneFormatCount] = '\0';
-
-                    /* print this argument */
-                    ThisArg = (struct Value *)((char *)ThisArg + MEM_ALIGN(sizeof(struct Value) + TypeStackSizeValue(ThisArg)));
-                    if (ShowType == &pc->IntType)
-                    {
-                        /* show a signed integer */
-                        if (IS_NUMERIC_COERCIBLE(ThisArg))
-                            StdioFprintfWord(&SOStream, OneFormatBuf, ExpressionCoerceUnsignedInteger(ThisArg));
-                        else
-                            StdioOutPuts("XXX", &SOStream);
-                    }
+                    StdioFprintfWord(&SOStream, Directive->Text, ExpressionCoerceUnsignedInteger(ThisArg));
+                break;
 #ifndef NO_FP
-                    else if (ShowType == &pc->FPType)
-                    {
-                        /* show a floating point number */
-                        if (IS_NUMERIC_COERCIBLE(ThisArg))
-                            StdioFprintfFP(&SOStream, OneFormatBuf, ExpressionCoerceFP(ThisArg));
-                        else
-                            StdioOutPuts("XXX", &SOStream);
-                    }
+            case StdioDirectiveFP:
+                /* show a floating point number */
+                if (!IS_NUMERIC_COERCIBLE(ThisArg))
+                    StdioOutPuts("XXX", &SOStream);
+                else if (!Directive->Fast || !StdioFormatFP(&SOStream, Directive, ExpressionCoerceFP(ThisArg)))
+                    StdioFprintfFP(&SOStream, Directive->Text, ExpressionCoerceFP(ThisArg));
+                break;
 #endif
-                    else if (ShowType == pc->CharPtrType)
-                    {
-                        if (ThisArg->Typ->Base == TypePointer)
-                            StdioFprintfPointer(&SOStream, OneFormatBuf, ThisArg->Val->Pointer);
-
-                        else if (ThisArg->Typ->Base == TypeArray && ThisArg->Typ->FromType->Base == TypeChar)
-                            StdioFprintfPointer(&SOStream, OneFormatBuf, &ThisArg->Val->ArrayMem[0]);
-
-                        else
-                            StdioOutPuts("XXX", &SOStream);
-                    }
-                    else if (ShowType == pc->VoidPtrType)
-                    {
-                        if (ThisArg->Typ->Base == TypePointer)
-                            StdioFprintfPointer(&SOStream, OneFormatBuf, ThisArg->Val->Pointer);
-
-                        else if (ThisArg->Typ->Base == TypeArray)
-                            StdioFprintfPointer(&SOStream, OneFormatBuf, &ThisArg->Val->ArrayMem[0]);
-
-                        else
-                            StdioOutPuts("XXX", &SOStream);
-                    }
-
-                    ArgCount++;
+            case StdioDirectiveString:
+            {
+                const char *Str;
+
+                if (ThisArg->Typ->Base == TypePointer)
+                    Str = (const char *)ThisArg->Val->Pointer;
+
+                else if (ThisArg->Typ->Base == TypeArray && ThisArg->Typ->FromType->Base == TypeChar)
+                    Str = &ThisArg->Val->ArrayMem[0];
+
+                else
+                {
+                    StdioOutPuts("XXX", &SOStream);
+                    break;
                 }
+
+                if (Directive->Fast && Str != nullptr)
+                    StdioFormatStr(&SOStream, Directive, Str);
+                else
+                    StdioFprintfPointer(&SOStream, Directive->Text, (void *)Str);
+                break;
             }
+
+            case StdioDirectivePointer:
+                if (ThisArg->Typ->Base == TypePointer)
+                    StdioFprintfPointer(&SOStream, Directive->Text, ThisArg->Val->Pointer);
+
+                else if (ThisArg->Typ->Base == TypeArray)
+                    StdioFprintfPointer(&SOStream, Directive->Text, &ThisArg->Val->ArrayMem[0]);
+
+                else
+                    StdioOutPuts("XXX", &SOStream);
+                break;
+
+            default:
+                break;
         }
-        else
-        {
-            /* just output a normal character */
-            StdioOutPutc(*FPos, &SOStream);
-            FPos++;
-        }
+
+        ArgCount++;
     }
 
+    if (IsTemporary)
+        VariableFree(pc, FormatValue);
+
     /* null-terminate */
     if (SOStream.StrOutPtr != nullptr && SOStream.StrOutLen > 0)
         *SOStream.StrOutPtr = '\0';
@@ -348,6 +780,7 @@ int StdioBaseScanf(struct ParseState *Parser, FILE *Stream, char *StrIn, char *F
             ProgramFail(Parser, "non-pointer argument to scanf() - argument %d after format", ArgCount+1);
     }
 
+    PlatformFlush(Parser->pc->CStdOut);
     if (Stream != nullptr)
         return fscanf(Stream, Format, ScanfArg[0], ScanfArg[1], ScanfArg[2], ScanfArg[3], ScanfArg[4], ScanfArg[5], ScanfArg[6], ScanfArg[7], ScanfArg[8], ScanfArg[9]);
     else
@@ -362,31 +795,46 @@ void StdioFopen(struct ParseState *Parser, struct Value *ReturnValue, struct Val
 
 void StdioFreopen(struct ParseState *Parser, struct Value *ReturnValue, struct Value **Param, int NumArgs)
 {
+	if (Param[2]->Val->Pointer == stdout)
+		PlatformFlush(Parser->pc->CStdOut);
+
 	ReturnValue->Val->Pointer = freopen((const char*)Param[0]->Val->Pointer, (const char*)Param[1]->Val->Pointer, (FILE*)Param[2]->Val->Pointer);
 }
 
 void StdioFclose(struct ParseState *Parser, struct Value *ReturnValue, struct Value **Param, int NumArgs)
 {
+	if (Param[0]->Val->Pointer == stdout)
+		PlatformFlush(Parser->pc->CStdOut);
+
 	ReturnValue->Val->Integer = fclose((FILE*)Param[0]->Val->Pointer);
 }
 
 void StdioFread(struct ParseState *Parser, struct Value *ReturnValue, struct Value **Param, int NumArgs)
 {
+	PlatformFlush(Parser->pc->CStdOut);
 	ReturnValue->Val->Integer = fread(Param[0]->Val->Pointer, Param[1]->Val->Integer, Param[2]->Val->Integer, (FILE*)Param[3]->Val->Pointer);
 }
 
 void StdioFwrite(struct ParseState *Parser, struct Value *ReturnValue, struct Value **Param, int NumArgs)
 {
-	ReturnValue->Val->Integer = fwrite(Param[0]->Val->Pointer, Param[1]->Val->Integer, Param[2]->Val->Integer, (FILE*)Param[3]->Val->Pointer);
+	if (Param[3]->Val->Pointer == stdout)
+	{
+		PlatformWrite(Parser->pc->CStdOut, (const char*)Param[0]->Val->Pointer, Param[1]->Val->Integer * Param[2]->Val->Integer);
+		ReturnValue->Val->Integer = Param[2]->Val->Integer;
+	}
+	else
+		ReturnValue->Val->Integer = fwrite(Param[0]->Val->Pointer, Param[1]->Val->Integer, Param[2]->Val->Integer, (FILE*)Param[3]->Val->Pointer);
 }
 
 void StdioFgetc(struct ParseState *Parser, struct Value *ReturnValue, struct Value **Param, int NumArgs)
 {
+	PlatformFlush(Parser->pc->CStdOut);
 	ReturnValue->Val->Integer = fgetc((FILE*)Param[0]->Val->Pointer);
 }
 
 void StdioFgets(struct ParseState *Parser, struct Value *ReturnValue, struct Value **Param, int NumArgs)
 {
+	PlatformFlush(Parser->pc->CStdOut);
 	ReturnValue->Val->Pointer = fgets((char*)Param[0]->Val->Pointer, Param[1]->Val->Integer, (FILE*)Param[2]->Val->Pointer);
 }
 
@@ -436,6 +884,9 @@ void StdioFileno(struct ParseState *Parser, struct Value *ReturnValue, struct Va
 
 void StdioFflush(struct ParseState *Parser, struct Value *ReturnValue, struct Value **Param, int NumArgs)
 {
+	if (Param[0]->Val->Pointer == stdout || Param[0]->Val->Pointer == nullptr)
+		PlatformFlush(Parser->pc->CStdOut);
+
 	ReturnValue->Val->Integer = fflush((FILE*)Param[0]->Val->Pointer);
 }
 
@@ -451,12 +902,24 @@ void StdioFsetpos(struct ParseState *Parser, struct Value *ReturnValue, struct V
 
 void StdioFputc(struct ParseState *Parser, struct Value *ReturnValue, struct Value **Param, int NumArgs)
 {
-	ReturnValue->Val->Integer = fputc(Param[0]->Val->Integer, (FILE*)Param[1]->Val->Pointer);
+	if (Param[1]->Val->Pointer == stdout)
+	{
+		PrintCh(Param[0]->Val->Integer, Parser->pc->CStdOut);
+		ReturnValue->Val->Integer = (unsigned char)Param[0]->Val->Integer;
+	}
+	else
+		ReturnValue->Val->Integer = fputc(Param[0]->Val->Integer, (FILE*)Param[1]->Val->Pointer);
 }
 
 void StdioFputs(struct ParseState *Parser, struct Value *ReturnValue, struct Value **Param, int NumArgs)
 {
-	ReturnValue->Val->Integer = fputs((const char*)Param[0]->Val->Pointer, (FILE*)Param[1]->Val->Pointer);
+	if (Param[1]->Val->Pointer == stdout)
+	{
+		PrintStr((const char*)Param[0]->Val->Pointer, Parser->pc->CStdOut);
+		ReturnValue->Val->Integer = 0;
+	}
+	else
+		ReturnValue->Val->Integer = fputs((const char*)Param[0]->Val->Pointer, (FILE*)Param[1]->Val->Pointer);
 }
 
 void StdioFtell(struct ParseState *Parser, struct Value *ReturnValue, struct Value **Param, int NumArgs)
@@ -471,26 +934,40 @@ void StdioFseek(struct ParseState *Parser, struct Value *ReturnValue, struct Val
 
 void StdioPerror(struct ParseState *Parser, struct Value *ReturnValue, struct Value **Param, int NumArgs)
 {
+	PlatformFlush(Parser->pc->CStdOut);
 	perror((const char*)Param[0]->Val->Pointer);
 }
 
 void StdioPutc(struct ParseState *Parser, struct Value *ReturnValue, struct Value **Param, int NumArgs)
 {
-	ReturnValue->Val->Integer = putc(Param[0]->Val->Integer, (FILE*)Param[1]->Val->Pointer);
+	if (Param[1]->Val->Pointer == stdout)
+	{
+		PrintCh(Param[0]->Val->Integer, Parser->pc->CStdOut);
+		ReturnValue->Val->Integer = (unsigned char)Param[0]->Val->Integer;
+	}
+	else
+		ReturnValue->Val->Integer = putc(Param[0]->Val->Integer, (FILE*)Param[1]->Val->Pointer);
 }
 
 void StdioPutchar(struct ParseState *Parser, struct Value *ReturnValue, struct Value **Param, int NumArgs)
 {
-    ReturnValue->Val->Integer = putchar(Param[0]->Val->Integer);
+    PrintCh(Param[0]->Val->Integer, Parser->pc->CStdOut);
+    ReturnValue->Val->Integer = (unsigned char)Param[0]->Val->Integer;
 }
 
 void StdioSetbuf(struct ParseState *Parser, struct Value *ReturnValue, struct Value **Param, int NumArgs)
 {
+	if (Param[0]->Val->Pointer == stdout)
+		PlatformFlush(Parser->pc->CStdOut);
+
 	setbuf((FILE*)Param[0]->Val->Pointer, (char*)Param[1]->Val->Pointer);
 }
 
 void StdioSetvbuf(struct ParseState *Parser, struct Value *ReturnValue, struct Value **Param, int NumArgs)
 {
+	if (Param[0]->Val->Pointer == stdout)
+		PlatformFlush(Parser->pc->CStdOut);
+
 	setvbuf((FILE*)Param[0]->Val->Pointer, (char*)Param[1]->Val->Pointer, Param[2]->Val->Integer, Param[3]->Val->Integer);
 }
 
@@ -501,11 +978,14 @@ void StdioUngetc(struct ParseState *Parser, struct Value *ReturnValue, struct Va
 
 void StdioPuts(struct ParseState *Parser, struct Value *ReturnValue, struct Value **Param, int NumArgs)
 {
-    ReturnValue->Val->Integer = puts((const char*)Param[0]->Val->Pointer);
+    PrintStr((const char*)Param[0]->Val->Pointer, Parser->pc->CStdOut);
+    PrintCh('\n', Parser->pc->CStdOut);
+    ReturnValue->Val->Integer = 0;
 }
 
 void StdioGets(struct ParseState *Parser, struct Value *ReturnValue, struct Value **Param, int NumArgs)
 {
+    PlatformFlush(Parser->pc->CStdOut);
     ReturnValue->Val->Pointer = fgets((char*)Param[0]->Val->Pointer, GETS_MAXValue, stdin);
     if (ReturnValue->Val->Pointer != nullptr)
     {
@@ -517,6 +997,7 @@ void StdioGets(struct ParseState *Parser, struct Value *ReturnValue, struct Valu
 
 void StdioGetchar(struct ParseState *Parser, struct Value *ReturnValue, struct Value **Param, int NumArgs)
 {
+    PlatformFlush(Parser->pc->CStdOut);
     ReturnValue->Val->Integer = getchar();
 }
 
@@ -716,22 +1197,41 @@ void StdioSetupFunc(Picoc *pc)
 }
 
 /* portability-related I/O calls */
-void PrintCh(char OutCh, FILE *Stream)
+void PrintCh(char OutCh, IOFILE *Stream)
 {
-	putc(OutCh, Stream);
+	if (Stream->Policy == OutputFlushFull && Stream->Used < OUTPUT_BUFFER_SIZE)
+		Stream->Buf[Stream->Used++] = OutCh;
+	else
+		PlatformWrite(Stream, &OutCh, 1);
 }
 
-void PrintSimpleInt(long Num, FILE *Stream)
+void PrintSimpleInt(long Num, IOFILE *Stream)
 {
-	fprintf(Stream, "%ld", Num);
+	char NumBuf[MAX_CONVERSION];
+	char *End = &NumBuf[MAX_CONVERSION];
+	char *Pos = LibFormatUnsigned(End, (Num < 0) ? 0UL - (unsigned long)Num : (unsigned long)Num);
+
+	if (Num < 0)
+		*--Pos = '-';
+
+	PlatformWrite(Stream, Pos, End - Pos);
 }
 
-void PrintStr(const char *Str, FILE *Stream)
+void PrintStr(const char *Str, IOFILE *Stream)
 {
-	fputs(Str, Stream);
+	PlatformWrite(Stream, Str, strlen(Str));
 }
 
-void PrintFP(double Num, FILE *Stream)
+void PrintFP(double Num, IOFILE *Stream)
 {
-	fprintf(Stream, "%f", Num);
+	char NumBuf[MAX_CONVERSION];
+	int CCount = LibFormatFP(&NumBuf[0], Num, 6);
+
+	if (CCount < 0)
+		CCount = snprintf(&NumBuf[0], sizeof(NumBuf), "%f", Num);
+
+	if (CCount >= (int)sizeof(NumBuf))
+		CCount = sizeof(NumBuf) - 1;
+
+	PlatformWrite(Stream, &NumBuf[0], CCount);
 }
@@ -5,27 +5,30 @@ static int Stdlib_ZeroValue = 0;
 
 void StdlibAtof(struct ParseState *Parser, struct Value *ReturnValue, struct Value **Param, int NumArgs)
 {
-	ReturnValue->Val->FP = atof((const char*)Param[0]->Val->Pointer);
+	ReturnValue->Val->FP = LibStrToFP((const char*)Param[0]->Val->Pointer, nullptr);
 }
 
 void StdlibAtoi(struct ParseState *Parser, struct Value *ReturnValue, struct Value **Param, int NumArgs)
 {
-	ReturnValue->Val->Integer = atoi((const char*)Param[0]->Val->Pointer);
+	ReturnValue->Val->Integer = (int)LibStrToLong((const char*)Param[0]->Val->Pointer, nullptr);
 }
 
 void StdlibAtol(struct ParseState *Parser, struct Value *ReturnValue, struct Value **Param, int NumArgs)
 {
-	ReturnValue->Val->Integer = atol((const char*)Param[0]->Val->Pointer);
+	ReturnValue->Val->Integer = LibStrToLong((const char*)Param[0]->Val->Pointer, nullptr);
 }
 
 void StdlibStrtod(struct ParseState *Parser, struct Value *ReturnValue, struct Value **Param, int NumArgs)
 {
-	ReturnValue->Val->FP = strtod((const char*)Param[0]->Val->Pointer, (char**)Param[1]->Val->Pointer);
+	ReturnValue->Val->FP = LibStrToFP((const char*)Param[0]->Val->Pointer, (char**)Param[1]->Val->Pointer);
 }
 
 void StdlibStrtol(struct ParseState *Parser, struct Value *ReturnValue, struct Value **Param, int NumArgs)
 {
-	ReturnValue->Val->Integer = strtol((const char*)Param[0]->Val->Pointer, (char**)Param[1]->Val->Pointer, Param[2]->Val->Integer);
+	if (Param[2]->Val->Integer == 10)
+		ReturnValue->Val->Integer = LibStrToLong((const char*)Param[0]->Val->Pointer, (char**)Param[1]->Val->Pointer);
+	else
+		ReturnValue->Val->Integer = strtol((const char*)Param[0]->Val->Pointer, (char**)Param[1]->Val->Pointer, Param[2]->Val->Integer);
 }
 
 void StdlibStrtoul(struct ParseState *Parser, struct Value *ReturnValue, struct Value **Param, int NumArgs)
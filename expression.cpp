@@ -12,12 +12,18 @@
         if (IS_FP(BottomValue)) { ResultFP = ExpressionAssignFP(Parser, BottomValue, value); } \
         else { ResultInt = ExpressionAssignInt(Parser, BottomValue, (long)(value), false); ResultIsInt = true; } \
 
-#define DEEP_PRECEDENCE (BRACKET_PRECEDENCE*1000)
+/* operators whose result is constant if their operands are, so the tokens can be folded */
+#define IS_FOLDABLE_PREFIX(op) ((op) == TokenPlus || (op) == TokenMinus || (op) == TokenUnaryNot || (op) == TokenUnaryExor)
+#define IS_FOLDABLE_INFIX(op) ((op) >= TokenArithmeticOr && (op) <= TokenModulus)
+#define EXPRESSION_BRACKET_DEPTH_MAX 16     /* constants in brackets nested deeper than this are folded without their brackets */
+
+/* element types which can be loaded and stored directly */
+#define IS_SCALAR_TYPE(t) (IS_INTEGER_NUMERIC_TYPE(t) || (t)->Base == TypeFP || (t)->Base == TypePointer)
 
 #ifdef DEBUG_EXPRESSIONS
 #define debugf printf
 #else
-void debugf(char *Format, ...)
+void debugf(char *, ...)
 {
 }
 #endif
@@ -39,6 +45,16 @@ struct ExpressionStack
     enum LexToken Op;                   /* the operator */
     short unsigned int Precedence;      /* the operator precedence of this node */
     unsigned char Order;                /* the evaluation order of this operator */
+    const unsigned char *ConstStart;    /* if this is a constant value, the start of its tokens. for an operator, the start of its token */
+    const unsigned char *ConstEnd;      /* the end of a constant value's tokens */
+};
+
+/* where an operand which was skipped by && || or ?: ends */
+struct ExpressionOperandExtent
+{
+    const unsigned char *End;           /* the token after the operand */
+    unsigned char EndToken;             /* what that token was, to check the tokens haven't been reused */
+    int Lines;                          /* line ends in the operand */
 };
 
 /* operator precedence definitions */
@@ -75,7 +91,7 @@ static struct OpPrecedence OperatorPrecedence[] =
     /* TokenOpenBracket, */ { 15, 0, 0, (char*)"(" }, /* TokenCloseBracket, */ { 0, 15, 0, (char*)")" }
 };
 
-void ExpressionParseFunctionCall(struct ParseState *Parser, struct ExpressionStack **StackTop, const char *FuncName, int RunIt);
+int ExpressionParseFunctionCall(struct ParseState *Parser, struct ExpressionStack **StackTop, const char *FuncName, int RunIt);
 
 #ifdef DEBUG_EXPRESSIONS
 /* show the contents of the expression stack */
@@ -285,6 +301,7 @@ void ExpressionStackPushValueNode(struct ParseState *Parser, struct ExpressionSt
     struct ExpressionStack *StackNode = (ExpressionStack*)VariableAlloc(Parser->pc, Parser, sizeof(struct ExpressionStack), false);
     StackNode->Next = *StackTop;
     StackNode->Val = ValueLoc;
+    StackNode->ConstStart = nullptr;
     *StackTop = StackNode;
 #ifdef FANCY_ERROR_MESSAGES
     StackNode->Line = Parser->Line;
@@ -333,6 +350,112 @@ void ExpressionStackPushDereference(struct ParseState *Parser, struct Expression
     ExpressionStackPushValueNode(Parser, StackTop, ValueLoc);
 }
 
+/* fail if an array index is out of bounds. taking the address of the element just past the end is allowed */
+static void ExpressionCheckIndex(struct ParseState *Parser, struct ValueType *ArrayType, long Index, int AddressTaken)
+{
+    if (ArrayType->ArraySize > 0 && (Index < 0 || Index > ArrayType->ArraySize || (Index == ArrayType->ArraySize && !AddressTaken)))
+        ProgramFail(Parser, "array index %d is out of bounds", (int)Index);
+}
+
+/* push the Typ at Loc on to the expression stack. the value and its stack node are made in
+ * a single allocation and filled in here, since an element or pointed-to value needs nothing
+ * more. the operators all take Values so a Value is still needed. the node goes above the
+ * value, as it would if they were allocated separately, since the node is popped first */
+static void ExpressionStackPushAddress(struct ParseState *Parser, struct ExpressionStack **StackTop, struct ValueType *Typ, void *Loc, int IsLValue, struct Value *LValueFrom)
+{
+    struct Value *ValueLoc = (struct Value *)VariableAlloc(Parser->pc, Parser, MEM_ALIGN(sizeof(struct Value)) + sizeof(struct ExpressionStack), false);
+    struct ExpressionStack *StackNode = (struct ExpressionStack *)((char *)ValueLoc + MEM_ALIGN(sizeof(struct Value)));
+
+    ValueLoc->Typ = Typ;
+    ValueLoc->Val = (union AnyValue *)Loc;
+    ValueLoc->IsLValue = IsLValue;
+    ValueLoc->LValueFrom = LValueFrom;
+    StackNode->Next = *StackTop;
+    StackNode->Val = ValueLoc;
+    *StackTop = StackNode;
+#ifdef FANCY_ERROR_MESSAGES
+    StackNode->Line = Parser->Line;
+    StackNode->CharacterPos = Parser->CharacterPos;
+#endif
+#ifdef DEBUG_EXPRESSIONS
+    ExpressionStackShow(Parser->pc, *StackTop);
+#endif
+}
+
+/* push a scalar element of an array or pointer variable directly when it's indexed by a
+ * variable or a constant, e.g. a[i] or p[3], without evaluating the index as an expression.
+ * the parser is just after the array variable. returns false if it's not that simple */
+static int ExpressionPushElement(struct ParseState *Parser, struct ExpressionStack **StackTop, struct Value *ArrayValue, int AddressTaken)
+{
+    struct ParseState IndexState;
+    struct Value *IndexValue;
+    enum LexToken IndexToken;
+    struct ValueType *ElementType = ArrayValue->Typ->FromType;
+    long Index;
+    char *ElementLoc;
+
+    if ((ArrayValue->Typ->Base != TypeArray && ArrayValue->Typ->Base != TypePointer) || !IS_SCALAR_TYPE(ElementType))
+        return false;
+
+    ParserCopy(&IndexState, Parser);
+    if (LexGetToken(&IndexState, nullptr, true) != TokenLeftSquareBracket)
+        return false;
+
+    IndexToken = LexGetToken(&IndexState, &IndexValue, true);
+    if ((IndexToken != TokenIdentifier && IndexToken != TokenIntegerConstant) || LexGetToken(&IndexState, nullptr, true) != TokenRightSquareBracket)
+        return false;
+
+    if (IndexToken == TokenIdentifier)
+    {
+        VariableGet(Parser->pc, Parser, IndexValue->Val->Identifier, &IndexValue);
+        if (!IS_INTEGER_NUMERIC(IndexValue))
+            return false;
+    }
+
+    Index = ExpressionCoerceInteger(IndexValue);
+    if (ArrayValue->Typ->Base == TypeArray)
+    {
+        ExpressionCheckIndex(Parser, ArrayValue->Typ, Index, AddressTaken);
+        ElementLoc = &ArrayValue->Val->ArrayMem[0];
+    }
+    else
+        ElementLoc = (char *)ArrayValue->Val->Pointer;
+
+    ParserCopy(Parser, &IndexState);
+    ExpressionStackPushAddress(Parser, StackTop, ElementType, ElementLoc + ElementType->Sizeof * Index, ArrayValue->IsLValue, ArrayValue->IsLValue ? ArrayValue : nullptr);
+    return true;
+}
+
+/* push the scalar pointed to by a pointer variable directly, e.g. *p, instead of pushing
+ * the dereference operator. the parser is just after the '*'. returns false if the
+ * variable is part of a larger operand, e.g. *p++ or *p[1], or isn't a simple pointer */
+static int ExpressionPushPointedTo(struct ParseState *Parser, struct ExpressionStack **StackTop)
+{
+    struct ParseState PointerState;
+    struct Value *PointerValue;
+    enum LexToken NextToken;
+
+    ParserCopy(&PointerState, Parser);
+    if (LexGetToken(&PointerState, &PointerValue, true) != TokenIdentifier)
+        return false;
+
+    NextToken = LexGetToken(&PointerState, nullptr, false);
+    if (NextToken == TokenOpenBracket || NextToken == TokenLeftSquareBracket || NextToken == TokenDot || NextToken == TokenArrow ||
+            NextToken == TokenIncrement || NextToken == TokenDecrement)
+        return false;
+
+    VariableGet(Parser->pc, Parser, PointerValue->Val->Identifier, &PointerValue);
+    if (PointerValue->Typ->Base != TypePointer || !IS_SCALAR_TYPE(PointerValue->Typ->FromType))
+        return false;
+
+    if (PointerValue->Val->Pointer == nullptr)
+        ProgramFail(Parser, "NULL pointer dereference");
+
+    ParserCopy(Parser, &PointerState);
+    ExpressionStackPushAddress(Parser, StackTop, PointerValue->Typ->FromType, PointerValue->Val->Pointer, true, nullptr);
+    return true;
+}
+
 void ExpressionPushInt(struct ParseState *Parser, struct ExpressionStack **StackTop, long IntValue)
 {
     struct Value *ValueLoc = VariableAllocValueFromType(Parser->pc, Parser, &Parser->pc->IntType, false, nullptr, false);
@@ -483,7 +606,7 @@ void ExpressionAssign(struct ParseState *Parser, struct Value *DestValue, struct
 /* evaluate the first half of a ternary operator x ? y : z */
 void ExpressionQuestionMarkOperator(struct ParseState *Parser, struct ExpressionStack **StackTop, struct Value *BottomValue, struct Value *TopValue)
 {
-    if (!IS_NUMERIC_COERCIBLE(TopValue))
+    if (!IS_NUMERIC_COERCIBLE_PLUS_POINTERS(TopValue, true))
         ProgramFail(Parser, "first argument to '?' should be a number");
 
     if (ExpressionCoerceInteger(TopValue))
@@ -584,6 +707,11 @@ void ExpressionPrefixOperator(struct ParseState *Parser, struct ExpressionStack
 
                 ExpressionPushInt(Parser, StackTop, ResultInt);
             }
+            else if (TopValue->Typ->Base == TypePointer && Op == TokenUnaryNot)
+            {
+                /* a NULL pointer test */
+                ExpressionPushInt(Parser, StackTop, TopValue->Val->Pointer == nullptr);
+            }
             else if (TopValue->Typ->Base == TypePointer)
             {
                 /* pointer prefix arithmetic */
@@ -696,6 +824,8 @@ void ExpressionInfixOperator(struct ParseState *Parser, struct ExpressionStack *
             ProgramFail(Parser, "array index must be an integer");
 
         ArrayIndex = ExpressionCoerceInteger(TopValue);
+        if (BottomValue->Typ->Base == TypeArray)
+            ExpressionCheckIndex(Parser, BottomValue->Typ, ArrayIndex, *StackTop != nullptr && (*StackTop)->Order == OrderPrefix && (*StackTop)->Op == TokenAmpersand);
 
         /* make the array element result */
         switch (BottomValue->Typ->Base)
@@ -713,6 +843,16 @@ void ExpressionInfixOperator(struct ParseState *Parser, struct ExpressionStack *
     else if (Op == TokenColon)
         ExpressionColonOperator(Parser, StackTop, TopValue, BottomValue);
 
+    else if ((Op == TokenLogicalOr || Op == TokenLogicalAnd) && (TopValue->Typ->Base == TypePointer || BottomValue->Typ->Base == TypePointer) &&
+             IS_NUMERIC_COERCIBLE_PLUS_POINTERS(TopValue, true) && IS_NUMERIC_COERCIBLE_PLUS_POINTERS(BottomValue, true))
+    {
+        /* a pointer is true if it's not NULL */
+        long TopInt = ExpressionCoerceInteger(TopValue) != 0;
+        long BottomInt = ExpressionCoerceInteger(BottomValue) != 0;
+
+        ExpressionPushInt(Parser, StackTop, Op == TokenLogicalOr ? (BottomInt || TopInt) : (BottomInt && TopInt));
+    }
+
 #ifndef NO_FP
     else if ( (TopValue->Typ == &Parser->pc->FPType && BottomValue->Typ == &Parser->pc->FPType) ||
               (TopValue->Typ == &Parser->pc->FPType && IS_NUMERIC_COERCIBLE(BottomValue)) ||
@@ -887,14 +1027,30 @@ void ExpressionInfixOperator(struct ParseState *Parser, struct ExpressionStack *
         ProgramFail(Parser, "invalid operation");
 }
 
+/* mark the value on the top of the stack as a constant which came from the tokens Start to End */
+static void ExpressionStackSetConstant(struct ExpressionStack *StackTop, const unsigned char *Start, const unsigned char *End)
+{
+    StackTop->ConstStart = Start;
+    StackTop->ConstEnd = End;
+}
+
+/* a constant value is being used by a non-constant operation, so replace its tokens with its value */
+static void ExpressionFoldConstant(struct ParseState *Parser, struct ExpressionStack *ValueNode)
+{
+    if (ValueNode->ConstStart != nullptr)
+        LexFoldConstant(Parser, ValueNode->ConstStart, ValueNode->ConstEnd, ValueNode->Val);
+}
+
 /* take the contents of the expression stack and compute the top until there's nothing greater than the given precedence */
-void ExpressionStackCollapse(struct ParseState *Parser, struct ExpressionStack **StackTop, int Precedence, int *IgnorePrecedence)
+void ExpressionStackCollapse(struct ParseState *Parser, struct ExpressionStack **StackTop, int Precedence)
 {
     int FoundPrecedence = Precedence;
     struct Value *TopValue;
     struct Value *BottomValue;
     struct ExpressionStack *TopStackNode = *StackTop;
     struct ExpressionStack *TopOperatorNode;
+    const unsigned char *ConstStart;
+    const unsigned char *ConstEnd;
 
     debugf((char*)"ExpressionStackCollapse(%d):\n", Precedence);
 #ifdef DEBUG_EXPRESSIONS
@@ -931,10 +1087,22 @@ void ExpressionStackCollapse(struct ParseState *Parser, struct ExpressionStack *
                     *StackTop = TopOperatorNode->Next;
 
                     /* do the prefix operation */
-                    if (Parser->Mode == RunModeRun /* && FoundPrecedence < *IgnorePrecedence */)
+                    if (Parser->Mode == RunModeRun)
                     {
+                        /* a constant operand either becomes part of a larger constant or is folded now */
+                        ConstStart = nullptr;
+                        if (TopStackNode->ConstStart != nullptr && TopOperatorNode->ConstStart != nullptr && IS_FOLDABLE_PREFIX(TopOperatorNode->Op))
+                        {
+                            ConstStart = TopOperatorNode->ConstStart;
+                            ConstEnd = TopStackNode->ConstEnd;
+                        }
+                        else
+                            ExpressionFoldConstant(Parser, TopStackNode);
+
                         /* run the operator */
                         ExpressionPrefixOperator(Parser, StackTop, TopOperatorNode->Op, TopValue);
+                        if (ConstStart != nullptr)
+                            ExpressionStackSetConstant(*StackTop, ConstStart, ConstEnd);
                     }
                     else
                     {
@@ -958,7 +1126,7 @@ void ExpressionStackCollapse(struct ParseState *Parser, struct ExpressionStack *
                     *StackTop = TopStackNode->Next->Next;
 
                     /* do the postfix operation */
-                    if (Parser->Mode == RunModeRun /* && FoundPrecedence < *IgnorePrecedence */)
+                    if (Parser->Mode == RunModeRun)
                     {
                         /* run the operator */
                         ExpressionPostfixOperator(Parser, StackTop, TopOperatorNode->Op, TopValue);
@@ -991,10 +1159,25 @@ void ExpressionStackCollapse(struct ParseState *Parser, struct ExpressionStack *
                         *StackTop = TopOperatorNode->Next->Next;
 
                         /* do the infix operation */
-                        if (Parser->Mode == RunModeRun /* && FoundPrecedence <= *IgnorePrecedence */)
+                        if (Parser->Mode == RunModeRun)
                         {
+                            /* constant operands either become part of a larger constant or are folded now */
+                            ConstStart = nullptr;
+                            if (TopStackNode->ConstStart != nullptr && TopOperatorNode->Next->ConstStart != nullptr && IS_FOLDABLE_INFIX(TopOperatorNode->Op))
+                            {
+                                ConstStart = TopOperatorNode->Next->ConstStart;
+                                ConstEnd = TopStackNode->ConstEnd;
+                            }
+                            else
+                            {
+                                ExpressionFoldConstant(Parser, TopOperatorNode->Next);
+                                ExpressionFoldConstant(Parser, TopStackNode);
+                            }
+
                             /* run the operator */
                             ExpressionInfixOperator(Parser, StackTop, TopOperatorNode->Op, BottomValue, TopValue);
+                            if (ConstStart != nullptr)
+                                ExpressionStackSetConstant(*StackTop, ConstStart, ConstEnd);
                         }
                         else
                         {
@@ -1011,10 +1194,6 @@ void ExpressionStackCollapse(struct ParseState *Parser, struct ExpressionStack *
                     assert(TopOperatorNode->Order != OrderNone);
                     break;
             }
-
-            /* if we've returned above the ignored precedence level turn ignoring off */
-            if (FoundPrecedence <= *IgnorePrecedence)
-                *IgnorePrecedence = DEEP_PRECEDENCE;
         }
 #ifdef DEBUG_EXPRESSIONS
         ExpressionStackShow(Parser->pc, *StackTop);
@@ -1035,6 +1214,7 @@ void ExpressionStackPushOperator(struct ParseState *Parser, struct ExpressionSta
     StackNode->Order = Order;
     StackNode->Op = Token;
     StackNode->Precedence = Precedence;
+    StackNode->ConstStart = nullptr;
     *StackTop = StackNode;
     debugf((char*)"ExpressionStackPushOperator()\n");
 #ifdef FANCY_ERROR_MESSAGES
@@ -1087,6 +1267,127 @@ void ExpressionGetStructElement(struct ParseState *Parser, struct ExpressionStac
     }
 }
 
+/* whether the right hand side of an infix operator just pushed can be skipped because its value
+ * won't be used. a pointer on the left counts as false if it's NULL. Level is the bracket level and TernaryTaken has a bit for each level which is
+ * set when its last '?' had a true condition, so the following ':' knows not to need its "else" */
+static int ExpressionOperandUnused(struct Value *LeftValue, enum LexToken Op, int Level, int *TernaryTaken)
+{
+    int LevelBit = Level < EXPRESSION_BRACKET_DEPTH_MAX ? 1 << Level : 0;
+    int Taken;
+
+    switch (Op)
+    {
+        case TokenLogicalAnd:
+            return IS_NUMERIC_COERCIBLE_PLUS_POINTERS(LeftValue, true) && !ExpressionCoerceInteger(LeftValue);
+
+        case TokenLogicalOr:
+            return IS_NUMERIC_COERCIBLE_PLUS_POINTERS(LeftValue, true) && ExpressionCoerceInteger(LeftValue);
+
+        case TokenQuestionMark:
+            if (!IS_NUMERIC_COERCIBLE_PLUS_POINTERS(LeftValue, true))
+                return false;
+
+            if (ExpressionCoerceInteger(LeftValue))
+            {
+                *TernaryTaken |= LevelBit;
+                return false;
+            }
+
+            *TernaryTaken &= ~LevelBit;
+            return true;
+
+        case TokenColon:
+            /* the "else" isn't needed if the "then" was taken, and ':' returns any non-void value on its left anyway */
+            Taken = (*TernaryTaken & LevelBit) != 0;
+            *TernaryTaken &= ~LevelBit;
+            return Taken || LeftValue->Typ->Base != TypeVoid;
+
+        default:
+            return false;
+    }
+}
+
+/* move the parser past the right hand side of the infix operator Op without evaluating it. the
+ * operand ends at the first operator outside brackets which binds no more tightly than Op, or at
+ * the end of the expression. its extent is recorded the first time so later runs jump straight
+ * past it */
+static void ExpressionSkipOperand(struct ParseState *Parser, enum LexToken Op)
+{
+    Picoc *pc = Parser->pc;
+    struct ParseState Scan;
+    struct Value *ExtentValue;
+    struct ExpressionOperandExtent *Extent;
+    const char *DeclFileName;
+    int DeclLine;
+    int DeclColumn;
+    int StopPrecedence = OperatorPrecedence[(int)Op].InfixPrecedence;
+    int Depth = 0;
+    int Done = false;
+
+    if (TableGet(&pc->OperandExtentTable, (const char *)Parser->Pos, &ExtentValue, &DeclFileName, &DeclLine, &DeclColumn))
+    {
+        Extent = (struct ExpressionOperandExtent *)ExtentValue->Val;
+        if (DeclFileName == Parser->FileName && DeclLine == Parser->Line && DeclColumn == Parser->CharacterPos && *Extent->End == Extent->EndToken)
+        {
+            Parser->Pos = Extent->End;
+            Parser->Line += Extent->Lines;
+            return;
+        }
+
+        /* the tokens at this position have been freed and reused for something else */
+        VariableFree(pc, TableDelete(pc, &pc->OperandExtentTable, (const char *)Parser->Pos));
+    }
+
+    ParserCopy(&Scan, Parser);
+    do
+    {
+        enum LexToken Token = LexGetToken(&Scan, nullptr, false);
+
+        switch (Token)
+        {
+            case TokenOpenBracket: case TokenOpenMacroBracket: case TokenLeftSquareBracket:
+                Depth++;
+                break;
+
+            case TokenCloseBracket: case TokenRightSquareBracket:
+                Done = Depth-- == 0;
+                break;
+
+            case TokenComma: case TokenSemicolon: case TokenLeftBrace: case TokenRightBrace:
+                Done = Depth == 0;
+                break;
+
+            case TokenEOF: case TokenEndOfFunction:
+                Done = true;
+                break;
+
+            default:
+                Done = Depth == 0 && (int)Token > TokenComma && (int)Token < TokenOpenBracket &&
+                        OperatorPrecedence[(int)Token].InfixPrecedence != 0 && OperatorPrecedence[(int)Token].InfixPrecedence <= StopPrecedence;
+                break;
+        }
+
+        if (!Done)
+            LexGetToken(&Scan, nullptr, true);
+
+    } while (!Done);
+
+    /* interactive tokens are freed after each statement so only operands in files are recorded. nor
+     * are ones with pre-processor conditionals which don't balance inside them */
+    if (Parser->FileName != pc->StrEmpty && Scan.HashIfLevel == Parser->HashIfLevel && Scan.HashIfEvaluateToLevel == Parser->HashIfEvaluateToLevel)
+    {
+        ExtentValue = VariableAllocValueAndData(pc, Parser, sizeof(struct ExpressionOperandExtent), false, nullptr, true);
+        ExtentValue->Typ = &pc->VoidType;
+        Extent = (struct ExpressionOperandExtent *)ExtentValue->Val;
+        Extent->End = Scan.Pos;
+        Extent->EndToken = *Scan.Pos;
+        Extent->Lines = Scan.Line - Parser->Line;
+        TableSet(pc, &pc->OperandExtentTable, (char *)Parser->Pos, ExtentValue, Parser->FileName, Parser->Line, Parser->CharacterPos);
+    }
+
+    ParserCopy(Parser, &Scan);
+}
+
 /* parse an expression with operator precedence */
 int ExpressionParse(struct ParseState *Parser, struct Value **Result)
 {
@@ -1096,9 +1397,11 @@ int ExpressionParse(struct ParseState *Parser, struct Value **Result)
     int BracketPrecedence = 0;
     int LocalPrecedence;
     int Precedence = 0;
-    int IgnorePrecedence = DEEP_PRECEDENCE;
     struct ExpressionStack *StackTop = nullptr;
     int TernaryDepth = 0;
+    int TernaryTaken = 0;       /* a bit for each bracket level whose last '?' had a true condition */
+    const unsigned char *BracketStart[EXPRESSION_BRACKET_DEPTH_MAX];   /* where each open '(' is, or nullptr for '[' */
+    const unsigned char *BracketInner[EXPRESSION_BRACKET_DEPTH_MAX];   /* where the tokens inside each open bracket start */
 
     debugf((char*)"ExpressionParse():\n");
     do
@@ -1140,7 +1443,7 @@ int ExpressionParse(struct ParseState *Parser, struct Value **Result)
                         /* scan and collapse the stack to the precedence of this infix cast operator, then push */
                         Precedence = BracketPrecedence + OperatorPrecedence[(int)TokenCast].PrefixPrecedence;
 
-                        ExpressionStackCollapse(Parser, &StackTop, Precedence+1, &IgnorePrecedence);
+                        ExpressionStackCollapse(Parser, &StackTop, Precedence+1);
                         CastTypeValue = VariableAllocValueFromType(Parser->pc, Parser, &Parser->pc->TypeType, false, nullptr, false);
                         CastTypeValue->Val->Typ = CastType;
                         ExpressionStackPushValueNode(Parser, &StackTop, CastTypeValue);
@@ -1150,8 +1453,18 @@ int ExpressionParse(struct ParseState *Parser, struct Value **Result)
                     {
                         /* boost the bracket operator precedence */
                         BracketPrecedence += BRACKET_PRECEDENCE;
+                        if (BracketPrecedence / BRACKET_PRECEDENCE < EXPRESSION_BRACKET_DEPTH_MAX)
+                        {
+                            BracketStart[BracketPrecedence / BRACKET_PRECEDENCE] = LexTokenStart(PreState.Pos);
+                            BracketInner[BracketPrecedence / BRACKET_PRECEDENCE] = LexTokenStart(Parser->Pos);
+                        }
                     }
                 }
+                else if (Token == TokenAsterisk && Parser->Mode == RunModeRun && ExpressionPushPointedTo(Parser, &StackTop))
+                {
+                    /* a pointer variable was dereferenced directly */
+                    PrefixState = false;
+                }
                 else
                 {
                     /* scan and collapse the stack to the precedence of this operator, then push */
@@ -1169,8 +1482,10 @@ int ExpressionParse(struct ParseState *Parser, struct Value **Result)
                             TempPrecedenceBoost = -1;
                     }
 
-                    ExpressionStackCollapse(Parser, &StackTop, Precedence, &IgnorePrecedence);
+                    ExpressionStackCollapse(Parser, &StackTop, Precedence);
                     ExpressionStackPushOperator(Parser, &StackTop, OrderPrefix, Token, Precedence + TempPrecedenceBoost);
+                    if (IS_FOLDABLE_PREFIX(Token))
+                        StackTop->ConstStart = LexTokenStart(PreState.Pos);
                 }
             }
             else
@@ -1191,7 +1506,14 @@ int ExpressionParse(struct ParseState *Parser, struct Value **Result)
                             else
                             {
                                 /* collapse to the bracket precedence */
-                                ExpressionStackCollapse(Parser, &StackTop, BracketPrecedence, &IgnorePrecedence);
+                                ExpressionStackCollapse(Parser, &StackTop, BracketPrecedence);
+
+                                /* a constant in brackets is folded along with its brackets */
+                                if (Token == TokenCloseBracket && BracketPrecedence / BRACKET_PRECEDENCE < EXPRESSION_BRACKET_DEPTH_MAX &&
+                                        BracketStart[BracketPrecedence / BRACKET_PRECEDENCE] != nullptr && StackTop != nullptr && StackTop->Order == OrderNone &&
+                                        StackTop->ConstStart != nullptr && StackTop->ConstStart == BracketInner[BracketPrecedence / BRACKET_PRECEDENCE])
+                                    ExpressionStackSetConstant(StackTop, BracketStart[BracketPrecedence / BRACKET_PRECEDENCE], Parser->Pos);
+
                                 BracketPrecedence -= BRACKET_PRECEDENCE;
                             }
                             break;
@@ -1199,7 +1521,7 @@ int ExpressionParse(struct ParseState *Parser, struct Value **Result)
                         default:
                             /* scan and collapse the stack to the precedence of this operator, then push */
                             Precedence = BracketPrecedence + OperatorPrecedence[(int)Token].PostfixPrecedence;
-                            ExpressionStackCollapse(Parser, &StackTop, Precedence, &IgnorePrecedence);
+                            ExpressionStackCollapse(Parser, &StackTop, Precedence);
                             ExpressionStackPushOperator(Parser, &StackTop, OrderPostfix, Token, Precedence);
                             break;
                     }
@@ -1212,9 +1534,9 @@ int ExpressionParse(struct ParseState *Parser, struct Value **Result)
                     /* for right to left order, only go down to the next higher precedence so we evaluate it in reverse order */
                     /* for left to right order, collapse down to this precedence so we evaluate it in forward order */
                     if (IS_LEFT_TO_RIGHT(OperatorPrecedence[(int)Token].InfixPrecedence))
-                        ExpressionStackCollapse(Parser, &StackTop, Precedence, &IgnorePrecedence);
+                        ExpressionStackCollapse(Parser, &StackTop, Precedence);
                     else
-                        ExpressionStackCollapse(Parser, &StackTop, Precedence+1, &IgnorePrecedence);
+                        ExpressionStackCollapse(Parser, &StackTop, Precedence+1);
 
                     if (Token == TokenDot || Token == TokenArrow)
                     {
@@ -1222,15 +1544,6 @@ int ExpressionParse(struct ParseState *Parser, struct Value **Result)
                     }
                     else
                     {
-                        /* if it's a && or || operator we may not need to evaluate the right hand side of the expression */
-                        if ( (Token == TokenLogicalOr || Token == TokenLogicalAnd) && IS_NUMERIC_COERCIBLE(StackTop->Val))
-                        {
-                            long LHSInt = ExpressionCoerceInteger(StackTop->Val);
-                            if ( ( (Token == TokenLogicalOr && LHSInt) || (Token == TokenLogicalAnd && !LHSInt) ) &&
-                                 (IgnorePrecedence > Precedence) )
-                                IgnorePrecedence = Precedence;
-                        }
-
                         /* push the operator on the stack */
                         ExpressionStackPushOperator(Parser, &StackTop, OrderInfix, Token, Precedence);
                         PrefixState = true;
@@ -1241,6 +1554,20 @@ int ExpressionParse(struct ParseState *Parser, struct Value **Result)
                             case TokenColon: TernaryDepth--; break;
                             default: break;
                         }
+
+                        /* && || and ?: jump over a right hand side whose value won't be used rather than evaluating it */
+                        if (Parser->Mode == RunModeRun && ExpressionOperandUnused(StackTop->Next->Val, Token, BracketPrecedence / BRACKET_PRECEDENCE, &TernaryTaken))
+                        {
+                            ExpressionSkipOperand(Parser, Token);
+
+                            /* a dummy operand gives the same result. ':' after a true '?' with a void "then" stays void */
+                            if (Token == TokenColon && StackTop->Next->Val->Typ->Base == TypeVoid)
+                                ExpressionStackPushValueByType(Parser, &StackTop, &Parser->pc->VoidType);
+                            else
+                                ExpressionPushInt(Parser, &StackTop, 0);
+
+                            PrefixState = false;
+                        }
                     }
 
                     /* treat an open square bracket as an infix array index operator followed by an open bracket */
@@ -1248,6 +1575,8 @@ int ExpressionParse(struct ParseState *Parser, struct Value **Result)
                     {
                         /* boost the bracket operator precedence, then push */
                         BracketPrecedence += BRACKET_PRECEDENCE;
+                        if (BracketPrecedence / BRACKET_PRECEDENCE < EXPRESSION_BRACKET_DEPTH_MAX)
+                            BracketStart[BracketPrecedence / BRACKET_PRECEDENCE] = nullptr;
                     }
                 }
                 else
@@ -1262,11 +1591,13 @@ int ExpressionParse(struct ParseState *Parser, struct Value **Result)
 
             if (LexGetToken(Parser, nullptr, false) == TokenOpenBracket)
             {
-                ExpressionParseFunctionCall(Parser, &StackTop, LexValue->Val->Identifier, Parser->Mode == RunModeRun && Precedence < IgnorePrecedence);
+                /* a macro call is replaced by its expansion, which still has an operand to come */
+                if (!ExpressionParseFunctionCall(Parser, &StackTop, LexValue->Val->Identifier, Parser->Mode == RunModeRun))
+                    continue;
             }
             else
             {
-                if (Parser->Mode == RunModeRun /* && Precedence < IgnorePrecedence */)
+                if (Parser->Mode == RunModeRun)
                 {
                     struct Value *VariableValue = nullptr;
 
@@ -1286,21 +1617,33 @@ int ExpressionParse(struct ParseState *Parser, struct Value **Result)
                             ProgramFail(&MacroParser, "expression expected");
 
                         ExpressionStackPushValueNode(Parser, &StackTop, MacroResult);
+
+                        /* once evaluated, a constant macro body has been folded to a single constant */
+                        if (LexIsConstant(VariableValue->Val->MacroDef.Body.Pos))
+                            ExpressionStackSetConstant(StackTop, LexTokenStart(PreState.Pos), Parser->Pos);
                     }
                     else if (VariableValue->Typ == &Parser->pc->VoidType)
                         ProgramFail(Parser, "a void value isn't much use here");
+                    else if (ExpressionPushElement(Parser, &StackTop, VariableValue,
+                                StackTop != nullptr && StackTop->Order == OrderPrefix && StackTop->Op == TokenAmpersand))
+                    {
+                        /* an element of an array was loaded directly */
+                    }
                     else
+                    {
                         ExpressionStackPushLValue(Parser, &StackTop, VariableValue, 0); /* it's a value variable */
+
+                        /* enum values are constants. other values which can't be written to, such as a
+                         * host's read-only platform variables, can still change so they aren't */
+                        if (VariableValue->IsConstant)
+                            ExpressionStackSetConstant(StackTop, LexTokenStart(PreState.Pos), Parser->Pos);
+                    }
                 }
                 else /* push a dummy value */
                     ExpressionPushInt(Parser, &StackTop, 0);
 
             }
 
-             /* if we've successfully ignored the RHS turn ignoring off */
-            if (Precedence <= IgnorePrecedence)
-                IgnorePrecedence = DEEP_PRECEDENCE;
-
             PrefixState = false;
         }
         else if ((int)Token > TokenCloseBracket && (int)Token <= TokenCharacterConstant)
@@ -1311,6 +1654,8 @@ int ExpressionParse(struct ParseState *Parser, struct Value **Result)
 
             PrefixState = false;
             ExpressionStackPushValue(Parser, &StackTop, LexValue);
+            if (Parser->Mode == RunModeRun && Token != TokenStringConstant)
+                ExpressionStackSetConstant(StackTop, LexTokenStart(PreState.Pos), Parser->Pos);
         }
         else if (IsTypeToken(Parser, Token, LexValue))
         {
@@ -1343,7 +1688,7 @@ int ExpressionParse(struct ParseState *Parser, struct Value **Result)
         ProgramFail(Parser, "brackets not closed");
 
     /* scan and collapse the stack to precedence 0 */
-    ExpressionStackCollapse(Parser, &StackTop, 0, &IgnorePrecedence);
+    ExpressionStackCollapse(Parser, &StackTop, 0);
 
     /* fix up the stack and return the result if we're in run mode */
     if (StackTop != nullptr)
@@ -1354,6 +1699,8 @@ int ExpressionParse(struct ParseState *Parser, struct Value **Result)
             if (StackTop->Order != OrderNone || StackTop->Next != nullptr)
                 ProgramFail(Parser, "invalid expression");
 
+            ExpressionFoldConstant(Parser, StackTop);
+
             *Result = StackTop->Val;
             //FIXME
             //HeapPopStack(Parser->pc, StackTop, sizeof(struct ExpressionStack));
@@ -1373,90 +1720,20 @@ int ExpressionParse(struct ParseState *Parser, struct Value **Result)
 }
 
 
-/* do a parameterised macro call */
-void ExpressionParseMacroCall(struct ParseState *Parser, struct ExpressionStack **StackTop, const char *MacroName, struct MacroDef *MDef)
+/* do a parameterised macro call by moving the parser on to the macro body with the arguments
+ * substituted in. the tokens after the expansion carry on after the call, so the expansion is
+ * parsed as part of the expression it's in */
+void ExpressionParseMacroCall(struct ParseState *Parser, const char *MacroName, struct MacroDef *MDef)
 {
-    struct Value *ReturnValue = nullptr;
-    struct Value *Param;
-    struct Value **ParamArray = nullptr;
-    int ArgCount;
-    enum LexToken Token;
-
-    if (Parser->Mode == RunModeRun)
-    {
-        /* create a stack frame for this macro */
-#ifndef NO_FP
-        ExpressionStackPushValueByType(Parser, StackTop, &Parser->pc->FPType);  /* largest return type there is */
-#else
-        ExpressionStackPushValueByType(Parser, StackTop, &Parser->pc->IntType);  /* largest return type there is */
-#endif
-        ReturnValue = (*StackTop)->Val;
-        HeapPushStackFrame(Parser->pc);
-        ParamArray = (Value**)HeapAllocStack(Parser->pc, sizeof(struct Value *) * MDef->NumParams);
-        if (ParamArray == nullptr)
-            ProgramFail(Parser, "out of memory");
-    }
-    else
-        ExpressionPushInt(Parser, StackTop, 0);
-
-    /* parse arguments */
-    ArgCount = 0;
-    do {
-        if (ExpressionParse(Parser, &Param))
-        {
-            if (Parser->Mode == RunModeRun)
-            {
-                if (ArgCount < MDef->NumParams)
-                    ParamArray[ArgCount] = Param;
-                else
-                    ProgramFail(Parser, "too many arguments to %s()", MacroName);
-            }
+    if (MDef->Body.Pos == nullptr)
+        ProgramFail(Parser, "'%s' is undefined", MacroName);
 
-            ArgCount++;
-            Token = LexGetToken(Parser, nullptr, true);
-            if (Token != TokenComma && Token != TokenCloseBracket)
-                ProgramFail(Parser, "comma expected");
-        }
-        else
-        {
-            /* end of argument list? */
-            Token = LexGetToken(Parser, nullptr, true);
-            if (!TokenCloseBracket)
-                ProgramFail(Parser, "bad argument");
-        }
-
-    } while (Token != TokenCloseBracket);
-
-    if (Parser->Mode == RunModeRun)
-    {
-        /* evaluate the macro */
-        struct ParseState MacroParser;
-        int Count;
-        struct Value *EvalValue;
-
-        if (ArgCount < MDef->NumParams)
-            ProgramFail(Parser, "not enough arguments to '%s'", MacroName);
-
-        if (MDef->Body.Pos == nullptr)
-            ProgramFail(Parser, "'%s' is undefined", MacroName);
-
-        ParserCopy(&MacroParser, &MDef->Body);
-        MacroParser.Mode = Parser->Mode;
-        VariableStackFrameAdd(Parser, MacroName, 0);
-        Parser->pc->TopStackFrame->NumParams = ArgCount;
-        Parser->pc->TopStackFrame->ReturnValue = ReturnValue;
-        for (Count = 0; Count < MDef->NumParams; Count++)
-            VariableDefine(Parser->pc, Parser, MDef->ParamName[Count], ParamArray[Count], nullptr, true);
-
-        ExpressionParse(&MacroParser, &EvalValue);
-        ExpressionAssign(Parser, ReturnValue, EvalValue, true, MacroName, 0, false);
-        VariableStackFramePop(Parser);
-        HeapPopStackFrame(Parser->pc);
-    }
+    Parser->Pos = LexExpandMacro(Parser, MDef, MacroName);
 }
 
-/* do a function call */
-void ExpressionParseFunctionCall(struct ParseState *Parser, struct ExpressionStack **StackTop, const char *FuncName, int RunIt)
+/* do a function call. returns false if it was a macro call, which leaves the parser at the
+ * macro's expansion rather than pushing a value */
+int ExpressionParseFunctionCall(struct ParseState *Parser, struct ExpressionStack **StackTop, const char *FuncName, int RunIt)
 {
     struct Value *ReturnValue = nullptr;
     struct Value *FuncValue = nullptr;
@@ -1474,8 +1751,8 @@ void ExpressionParseFunctionCall(struct ParseState *Parser, struct ExpressionSta
         if (FuncValue->Typ->Base == TypeMacro)
         {
             /* this is actually a macro, not a function */
-            ExpressionParseMacroCall(Parser, StackTop, FuncName, &FuncValue->Val->MacroDef);
-            return;
+            ExpressionParseMacroCall(Parser, FuncName, &FuncValue->Val->MacroDef);
+            return false;
         }
 
         if (FuncValue->Typ->Base != TypeFunction)
@@ -1537,6 +1814,9 @@ void ExpressionParseFunctionCall(struct ParseState *Parser, struct ExpressionSta
         if (ArgCount < FuncValue->Val->FuncDef.NumParams)
             ProgramFail(Parser, "not enough arguments to '%s'", FuncName);
 
+        if (Parser->pc->ProfileCalls)
+            ProfileEnter(Parser, FuncName, FuncValue->Val->FuncDef.Intrinsic != nullptr);
+
         if (FuncValue->Val->FuncDef.Intrinsic == nullptr)
         {
             /* run a user-defined function */
@@ -1578,10 +1858,14 @@ void ExpressionParseFunctionCall(struct ParseState *Parser, struct ExpressionSta
         	//FuncValue->Val->FuncDef.Intrinsic(Parser, ReturnValue, ParamArray, ArgCount);
             ((void (*)(struct ParseState *, struct Value *, struct Value **, int))(FuncValue->Val->FuncDef.Intrinsic))(Parser, ReturnValue, ParamArray, ArgCount);
 
+        if (Parser->pc->ProfileCalls)
+            ProfileLeave(Parser->pc);
+
         HeapPopStackFrame(Parser->pc);
     }
 
     Parser->Mode = OldMode;
+    return true;
 }
 
 /* parse an expression */
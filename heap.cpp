@@ -3,14 +3,19 @@
  * you can define USE_MALLOC_HEAP to use your system's own malloc() allocator */
 
 /* stack grows up from the bottom and heap grows down from the top of heap space */
+#include <stddef.h>
+
 #include "interpreter.h"
 
+#define HEAP_MEM_HEADER alignof(max_align_t)       /* room before each allocation for its size, keeping malloc()'s alignment */
+
 /* initialise the stack and heap storage */
 void HeapInit(Picoc *pc, int StackOrHeapSize)
 {
 	int AlignOffset = 0;
 
 	pc->HeapMemory = (unsigned char*)malloc(StackOrHeapSize);
+	pc->HeapSize = StackOrHeapSize;
 	pc->HeapBottom = nullptr;						/* the bottom of the (downward-growing) heap */
 	pc->StackFrame = nullptr;						/* the current stack frame */
 	pc->HeapStackTop = nullptr;						/* the top of the stack */
@@ -20,6 +25,7 @@ void HeapInit(Picoc *pc, int StackOrHeapSize)
 
 	pc->StackFrame = &(pc->HeapMemory)[AlignOffset];
 	pc->HeapStackTop = &(pc->HeapMemory)[AlignOffset];
+	pc->HeapStackPeak = pc->HeapStackTop;
 	*(void **)(pc->StackFrame) = nullptr;
 	pc->HeapBottom = &(pc->HeapMemory)[StackOrHeapSize-sizeof(ALIGN_TYPE)+AlignOffset];
 }
@@ -42,6 +48,9 @@ void *HeapAllocStack(Picoc *pc, int Size)
 		return nullptr;
 
 	pc->HeapStackTop = (void *)NewTop;
+	if (NewTop > (char *)pc->HeapStackPeak)
+		pc->HeapStackPeak = (void *)NewTop;
+
 	memset((void *)NewMem, '\0', Size);
 	return NewMem;
 }
@@ -53,6 +62,8 @@ void HeapUnpopStack(Picoc *pc, int Size)
 	printf("HeapUnpopStack(%ld) at 0x%lx\n", (unsigned long)MEM_ALIGN(Size), (unsigned long)pc->HeapStackTop);
 #endif
 	pc->HeapStackTop = (void *)((char *)pc->HeapStackTop + MEM_ALIGN(Size));
+	if (pc->HeapStackTop > pc->HeapStackPeak)
+		pc->HeapStackPeak = pc->HeapStackTop;
 }
 
 /* free some space at the top of the stack */
@@ -76,6 +87,8 @@ void HeapPushStackFrame(Picoc *pc)
 	*(void **)pc->HeapStackTop = pc->StackFrame;
 	pc->StackFrame = pc->HeapStackTop;
 	pc->HeapStackTop = (void *)((char *)pc->HeapStackTop + MEM_ALIGN(sizeof(ALIGN_TYPE)));
+	if (pc->HeapStackTop > pc->HeapStackPeak)
+		pc->HeapStackPeak = pc->HeapStackTop;
 }
 
 /* pop the current stack frame, freeing all memory in the frame. can return nullptr */
@@ -94,14 +107,116 @@ int HeapPopStackFrame(Picoc *pc)
 		return false;
 }
 
-/* allocate some dynamically allocated memory. memory is cleared. can return nullptr if out of memory */
+/* allocate some dynamically allocated memory. memory is cleared. can return nullptr if out of memory.
+ * the size is kept just before the memory so the live heap can be measured */
 void *HeapAllocMem(Picoc *pc, int Size)
 {
-	return calloc(Size, 1);
+	char *NewMem = (char *)calloc(HEAP_MEM_HEADER + Size, 1);
+	if (NewMem == nullptr)
+		return nullptr;
+
+	*(size_t *)NewMem = Size;
+	pc->HeapAllocCount++;
+	pc->HeapAllocBytes += Size;
+	pc->HeapLiveAllocs++;
+	pc->HeapLiveBytes += Size;
+	return NewMem + HEAP_MEM_HEADER;
+}
+
+/* resize some dynamically allocated memory, or allocate it if Mem is nullptr. new memory isn't cleared. can return nullptr if out of memory */
+void *HeapReallocMem(Picoc *pc, void *Mem, int Size)
+{
+	size_t OldSize = 0;
+	char *NewMem;
+
+	if (Mem != nullptr)
+	{
+		Mem = (void *)((char *)Mem - HEAP_MEM_HEADER);
+		OldSize = *(size_t *)Mem;
+	}
+
+	NewMem = (char *)realloc(Mem, HEAP_MEM_HEADER + Size);
+	if (NewMem == nullptr)
+		return nullptr;
+
+	*(size_t *)NewMem = Size;
+	pc->HeapAllocCount++;
+	pc->HeapAllocBytes += Size;
+	if (Mem == nullptr)
+		pc->HeapLiveAllocs++;
+
+	pc->HeapLiveBytes += Size - OldSize;
+	return NewMem + HEAP_MEM_HEADER;
 }
 
 /* free some dynamically allocated memory */
 void HeapFreeMem(Picoc *pc, void *Mem)
 {
+	if (Mem == nullptr)
+		return;
+
+	Mem = (void *)((char *)Mem - HEAP_MEM_HEADER);
+	pc->HeapLiveAllocs--;
+	pc->HeapLiveBytes -= *(size_t *)Mem;
 	free(Mem);
 }
+
+/* get the size some dynamically allocated memory was given */
+int HeapMemSize(void *Mem)
+{
+	return (int)*(size_t *)((char *)Mem - HEAP_MEM_HEADER);
+}
+
+/* count some dynamically allocated memory which another interpreter made as this
+ * interpreter's, since this one is taking it over and will free it */
+void HeapAdoptMem(Picoc *pc, void *Mem)
+{
+	pc->HeapLiveAllocs++;
+	pc->HeapLiveBytes += HeapMemSize(Mem);
+}
+
+/* get what the interpreter's memory is being used for right now */
+void PicocMemoryStats(Picoc *pc, struct MemoryStats *Stats)
+{
+	struct CleanupTokenNode *Node;
+	struct TableEntry *Entry;
+	struct Value *Val;
+	int Count;
+
+	memset((void *)Stats, '\0', sizeof(*Stats));
+	Stats->StackSize = pc->HeapSize;
+	Stats->StackBytes = (char *)pc->HeapStackTop - (char *)pc->HeapMemory;
+	Stats->StackPeakBytes = (char *)pc->HeapStackPeak - (char *)pc->HeapMemory;
+	Stats->HeapAllocs = pc->HeapLiveAllocs;
+	Stats->HeapBytes = pc->HeapLiveBytes;
+	Stats->TypeNodes = pc->NumTypeNodes;
+
+	for (Count = 0; Count < pc->StringTable.Size; Count++)
+	{
+		for (Entry = pc->StringTable.HashTable[Count]; Entry != nullptr; Entry = Entry->Next)
+		{
+			Stats->Strings++;
+			Stats->StringBytes += HeapMemSize(Entry);
+		}
+	}
+
+	for (Node = pc->CleanupTokenList; Node != nullptr; Node = Node->Next)
+	{
+		Stats->TokenBuffers++;
+		Stats->TokenBytes += HeapMemSize(Node->Tokens);
+	}
+
+	for (Count = 0; Count < pc->GlobalTable.Size; Count++)
+	{
+		for (Entry = pc->GlobalTable.HashTable[Count]; Entry != nullptr; Entry = Entry->Next)
+		{
+			Val = Entry->p.v.Val;
+			if ((Val->Typ == &pc->FunctionType && Val->Val->FuncDef.Intrinsic == nullptr && Val->Val->FuncDef.Body.Pos != nullptr) ||
+					(Val->Typ == &pc->MacroType && Val->Val->MacroDef.Body.Pos != nullptr))
+			{
+				Stats->Bodies++;
+				Stats->BodyBytes += HeapMemSize((void *)(Val->Typ == &pc->FunctionType ? Val->Val->FuncDef.Body.Pos : Val->Val->MacroDef.Body.Pos));
+			}
+		}
+	}
+}
@@ -54,8 +54,11 @@ void PicocIncludeAllSystemHeaders(Picoc *pc)
 {
     struct IncludeLibrary *ThisInclude = pc->IncludeLibList;
 
+    ProfilePhaseStart(pc);
     for (; ThisInclude != nullptr; ThisInclude = ThisInclude->NextLib)
         IncludeFile(pc, ThisInclude->IncludeName);
+
+    ProfilePhaseEnd(pc, "IncludeAllSystemHeaders");
 }
 
 /* include one of a number of predefined libraries, or perhaps an actual file */
@@ -71,6 +74,9 @@ void IncludeFile(Picoc *pc, char *FileName)
             /* found it - protect against multiple inclusion */
             if (!VariableDefined(pc, FileName))
             {
+                if (pc->TraceFileName != nullptr)
+                    ProfileTraceBegin(pc, FileName, "include");
+
                 VariableDefine(pc, nullptr, FileName, nullptr, &pc->VoidType, false);
 
                 /* run an extra startup function if there is one */
@@ -84,6 +90,9 @@ void IncludeFile(Picoc *pc, char *FileName)
                 /* set up the library functions */
                 if (LInclude->FuncList != nullptr)
                     LibraryAdd(pc, &pc->GlobalTable, FileName, LInclude->FuncList);
+
+                if (pc->TraceFileName != nullptr)
+                    ProfileTraceEnd(pc);
             }
 
             return;
@@ -91,7 +100,12 @@ void IncludeFile(Picoc *pc, char *FileName)
     }
 
     /* not a predefined file, read a real file */
+    if (pc->TraceFileName != nullptr)
+        ProfileTraceBegin(pc, FileName, "include");
+
     PicocPlatformScanFile(pc, FileName);
+    if (pc->TraceFileName != nullptr)
+        ProfileTraceEnd(pc);
 }
 
 #endif /* NO_HASH_INCLUDE */
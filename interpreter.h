@@ -14,14 +14,15 @@
 #define MEM_ALIGN(x) (((x) + sizeof(ALIGN_TYPE) - 1) & ~(sizeof(ALIGN_TYPE)-1))
 
 #define GETS_BUF_MAX 256
+#define LIB_FORMAT_FP_MAX 48                /* longest result from LibFormatFP() */
+#define LIB_PARSE_MAX 64                    /* numbers longer than this are parsed by the host */
 
 /* for debugging */
 #define PRINT_SOURCE_POS ({ PrintSourceTextErrorLine(Parser->pc->CStdOut, Parser->FileName, Parser->SourceText, Parser->Line, Parser->CharacterPos); PlatformPrintf(Parser->pc->CStdOut, "\n"); })
 #define PRINT_TYPE(typ) PlatformPrintf(Parser->pc->CStdOut, "%t\n", typ);
 
-/* small processors use a simplified FILE * for stdio, otherwise use the system FILE * */
-//typedef struct OutputStream IOFILE;
-typedef FILE IOFILE;
+/* interpreter output is collected in our own buffer and handed to a host-redirectable sink in bulk */
+typedef struct OutputBuffer IOFILE;
 
 /* coercion of numeric types to other numeric types */
 #define IS_FP(v) ((v)->Typ->Base == TypeFP)
@@ -71,7 +72,8 @@ enum LexToken
 	/* 0x52 */ TokenHashDefine, TokenHashInclude, TokenHashIf, TokenHashIfdef, TokenHashIfndef, TokenHashElse, TokenHashEndif,
 	/* 0x59 */ TokenNew, TokenDelete,
 	/* 0x5b */ TokenOpenMacroBracket,
-	/* 0x5c */ TokenEOF, TokenEndOfLine, TokenEndOfFunction
+	/* 0x5c */ TokenEOF, TokenEndOfLine, TokenEndOfFunction,
+	/* 0x5f */ TokenConstantRef, TokenFoldedConstant, TokenMacroReturn
 };
 
 /* used in dynamic memory allocation */
@@ -202,6 +204,7 @@ struct Value
 	char IsLValue;					/* is modifiable and is allocated somewhere we can usefully modify it */
 	int ScopeID;					/* to know when it goes out of scope */
 	char OutOfScope;
+	char IsConstant;				/* a constant such as an enum value, which can be folded into the tokens */
 };
 
 
@@ -306,6 +309,27 @@ struct OutputStream
 	union OutputStreamInfo i;
 };
 
+/* where buffered output goes when it's flushed */
+typedef void OutputSink(void *, const char *, int);
+
+/* when buffered output is passed on to the sink */
+enum OutputFlushPolicy
+{
+	OutputFlushFull,				/* when the buffer fills */
+	OutputFlushLine,				/* at the end of each line */
+	OutputFlushUnbuffered			/* straight away */
+};
+
+/* the interpreter's output buffer */
+struct OutputBuffer
+{
+	OutputSink *Sink;
+	void *SinkContext;
+	enum OutputFlushPolicy Policy;
+	int Used;
+	char Buf[OUTPUT_BUFFER_SIZE];
+};
+
 /* possible results of parsing a statement */
 enum ParseResult { ParseResultEOF, ParseResultError, ParseResultOk };
 
@@ -317,6 +341,92 @@ struct CleanupTokenNode
 	struct CleanupTokenNode *Next;
 };
 
+/* a source file the platform has loaded, released at cleanup */
+struct SourceFileNode
+{
+	const char *Text;
+	int Len;
+	int Mapped;						/* true if Text is a memory mapping rather than a heap buffer */
+	void *Tokens;					/* tokens lexed ahead which haven't been handed to the parser yet */
+	struct SourceFileNode *Next;
+};
+
+/* the hardware events which can be counted */
+enum ProfileCounter
+{
+	CounterCycles,
+	CounterInstructions,
+	CounterBranchMisses,
+	CounterL1DMisses,
+	CounterLLCMisses,
+	NumProfileCounters
+};
+
+/* the calls to a function and the time spent in it */
+struct ProfileEntry
+{
+	const char *FuncName;
+	unsigned long Calls;
+	int Active;						/* calls which are running, so recursion is only timed once */
+	long long InclusiveNs;			/* time including the functions it called */
+	long long SelfNs;				/* time excluding the functions it called */
+	long long SelfCounts[NumProfileCounters];	/* hardware events excluding the functions it called */
+};
+
+/* a profiled call which is running */
+struct ProfileFrame
+{
+	struct ProfileEntry *Entry;
+	long long StartNs;
+	long long ChildNs;				/* time spent in the functions it called */
+	long long StartCounts[NumProfileCounters];
+	long long ChildCounts[NumProfileCounters];
+};
+
+/* the time and memory taken by a phase of starting up */
+struct StartupPhase
+{
+	const char *Name;
+	long long Ns;
+	unsigned long Allocs;			/* dynamic allocations made */
+	unsigned long AllocBytes;
+};
+
+/* what an interpreter's memory is being used for */
+struct MemoryStats
+{
+	int StackSize;					/* the size of the interpreter stack */
+	int StackBytes;					/* stack in use now */
+	int StackPeakBytes;				/* the most stack which has been in use */
+	long HeapAllocs;				/* live dynamic allocations */
+	long HeapBytes;
+	int Strings;					/* entries in the shared string table */
+	int StringBytes;
+	int TokenBuffers;				/* token buffers kept for loaded source */
+	int TokenBytes;
+	int Bodies;						/* function and macro bodies */
+	int BodyBytes;
+	int TypeNodes;					/* types made by TypeAdd() */
+};
+
+/* the beginning or the end of something in a trace */
+struct TraceEvent
+{
+	const char *Name;				/* nullptr for the end of the innermost event */
+	const char *Category;
+	long long TimeUs;
+};
+
+/* how many times each line of a source file has run */
+struct LineCountFile
+{
+	const char *FileName;
+	const char *SourceText;			/* for annotating the report, or nullptr */
+	unsigned long *Counts;			/* indexed by line number */
+	int NumLines;
+	struct LineCountFile *Next;
+};
+
 /* linked list of lexical tokens used in interactive mode */
 struct TokenLine
 {
@@ -355,13 +465,28 @@ struct Picoc_Struct
 	int LexUseStatementPrompt;
 	union AnyValue LexAnyValue;
 	struct Value LexValue;
-	struct Table ReservedWordTable;
-	struct TableEntry *ReservedWordHashTable[RESERVED_WORD_TABLE_SIZE];
+	void *LexTokenSpace;			/* the token buffer being filled, freed if lexing fails */
 
 	/* the table of string literal values */
 	struct Table StringLiteralTable;
 	struct TableEntry *StringLiteralHashTable[STRING_LITERAL_TABLE_SIZE];
 
+	/* static variable storage, by declaration token position */
+	struct Table StaticSiteTable;
+	struct TableEntry *StaticSiteHashTable[STATIC_SITE_TABLE_SIZE];
+
+	/* values of constant expressions folded into the tokens, by token position */
+	struct Table FoldedConstantTable;
+	struct TableEntry *FoldedConstantHashTable[FOLDED_CONSTANT_TABLE_SIZE];
+
+	/* expansions of calls to macros with parameters, by call site */
+	struct Table MacroExpansionTable;
+	struct TableEntry *MacroExpansionHashTable[MACRO_EXPANSION_TABLE_SIZE];
+
+	/* extents of operands which && || and ?: didn't need, by where they start */
+	struct Table OperandExtentTable;
+	struct TableEntry *OperandExtentHashTable[OPERAND_EXTENT_TABLE_SIZE];
+
 	/* the stack */
 	struct StackFrame *TopStackFrame;
 
@@ -373,11 +498,18 @@ struct Picoc_Struct
 
 	/* heap memory */
 	unsigned char *HeapMemory;			/* stack memory since our heap is malloc()ed */
+	int HeapSize;						/* the size of HeapMemory */
 	void *HeapBottom;					/* the bottom of the (downward-growing) heap */
 	void *StackFrame;					/* the current stack frame */
 	void *HeapStackTop;					/* the top of the stack */
+	unsigned long HeapAllocCount;		/* dynamic allocations made, for statistics */
+	unsigned long HeapAllocBytes;
+	void *HeapStackPeak;				/* the highest the top of the stack has been */
+	long HeapLiveAllocs;				/* dynamic allocations which haven't been freed */
+	long HeapLiveBytes;
 
 	/* types */
+	int NumTypeNodes;					/* types made by TypeAdd() */
 	struct ValueType UberType;
 	struct ValueType IntType;
 	struct ValueType ShortType;
@@ -405,12 +537,49 @@ struct Picoc_Struct
 	int BreakpointCount;
 	int DebugManualBreak;
 
+	/* profiler */
+	int ProfileCalls;					/* function calls are being profiled or traced */
+	int ProfileEnabled;
+	const char *ProfileFileName;		/* where to write the profile as tab-separated values, or nullptr */
+	struct Table ProfileTable;			/* call counts and times, by function name */
+	struct TableEntry *ProfileHashTable[PROFILE_TABLE_SIZE];
+	struct ProfileFrame *ProfileStack;	/* profiled calls which are running */
+	int ProfileDepth;
+	int ProfileStackSize;
+	volatile int ProfileSamplePending;	/* set by the sampling timer, the sample is taken at the next statement */
+	const char *ProfileSampleFileName;	/* where to write the sampled call stacks, or nullptr if not sampling */
+	struct Table ProfileSampleTable;	/* sample counts, by folded call stack */
+	struct TableEntry *ProfileSampleHashTable[PROFILE_SAMPLE_TABLE_SIZE];
+	const char *LineCountFileName;		/* where to write the line count report, or nullptr if not counting */
+	struct LineCountFile *LineCountList;
+	struct LineCountFile *LineCountLast;	/* the file the last line counted was in */
+	const char *TraceFileName;			/* where to write the trace, or nullptr if not tracing */
+	struct TraceEvent *TraceEvents;		/* events buffered until the trace is written */
+	int NumTraceEvents;
+	int TraceEventsSize;
+	int TraceDepth;						/* events which have begun and not ended */
+	int ProfileCounting;				/* hardware counters are being read */
+	int ProfileCounterFd[NumProfileCounters];	/* -1 for a counter which isn't available */
+	int ProfileCounterGroup;			/* the counter the others are read with */
+	int ProfileCounterDepth;			/* loads and runs being counted, which can nest */
+	long long *ProfileCounterTotals;	/* where the outermost of them is being added up */
+	long long ProfileCounterStart[NumProfileCounters];
+	long long ProfileLoadCounts[NumProfileCounters];	/* hardware events while loading source */
+	long long ProfileRunCounts[NumProfileCounters];		/* hardware events while running main() */
+	struct StartupPhase StartupPhases[STARTUP_PHASE_MAX];	/* what each phase of starting up took */
+	int NumStartupPhases;
+	long long PhaseStartNs;				/* when the phase being timed started */
+	unsigned long PhaseStartAllocs;
+	unsigned long PhaseStartAllocBytes;
+
 	/* C library */
 	int BigEndian;
 	int LittleEndian;
 
 	IOFILE *CStdOut;
 	IOFILE CStdOutBase;
+	struct Table PrintfFormatTable;		/* parsed printf formats, by string literal address */
+	struct TableEntry *PrintfFormatHashTable[PRINTF_FORMAT_TABLE_SIZE];
 
 	/* the picoc version string */
 	const char *VersionString;
@@ -418,6 +587,10 @@ struct Picoc_Struct
 	/* exit longjump buffer */
 	jmp_buf PicocExitBuf;
 
+	/* source files loaded by the platform */
+	struct SourceFileNode *SourceFileList;
+	void *ScanFilesSpace;			/* working space of PicocPlatformScanFiles(), freed at cleanup if scanning fails */
+
 	/* string table */
 	struct Table StringTable;
 	struct TableEntry *StringHashTable[STRING_TABLE_SIZE];
@@ -438,21 +611,32 @@ void TableStrFree(Picoc *);
 /* lex.c */
 void LexInit(Picoc *);
 void LexCleanup(Picoc *);
+void LexFreeTokenSpace(Picoc *);
 void *LexAnalyse(Picoc *, const char *, const char *, int, int *);
+void LexAdoptTokens(Picoc *, void *);
+void *LexCopyTokensTo(Picoc *, Picoc *, const unsigned char *);
+char *LexRegisterStringLiteral(Picoc *, const char *, int);
 void LexInitParser(struct ParseState *, Picoc *, const char *, void *, char *, int, int);
 enum LexToken LexGetToken(struct ParseState *, struct Value **, int);
+int LexSkipBlock(struct ParseState *);
 enum LexToken LexRawPeekToken(struct ParseState *);
 void LexToEndOfLine(struct ParseState *);
 void *LexCopyTokens(struct ParseState *, struct ParseState *);
 void LexInteractiveClear(Picoc *, struct ParseState *);
 void LexInteractiveCompleted(Picoc *, struct ParseState *);
 void LexInteractiveStatementPrompt(Picoc *);
+const unsigned char *LexTokenStart(const unsigned char *);
+int LexNextTokenLine(struct ParseState *);
+int LexIsConstant(const unsigned char *);
+int LexFoldConstant(struct ParseState *, const unsigned char *, const unsigned char *, struct Value *);
+const unsigned char *LexExpandMacro(struct ParseState *, struct MacroDef *, const char *);
 
 /* parse.c */
 /* the following are defined in picoc.h:
  * void PicocParse(const char *FileName, const char *Source, int SourceLen, int RunIt, int CleanupNow, int CleanupSource);
  * void PicocParseInteractive(); */
 void PicocParseInteractiveNoStartPrompt(Picoc *, int);
+void ParseTokens(Picoc *, const char *, const char *, void *, int, int, int, int);
 enum ParseResult ParseStatement(struct ParseState *, int);
 struct Value *ParseFunctionDefinition(struct ParseState *, struct ValueType *, char *);
 void ParseCleanup(Picoc *pc);
@@ -479,6 +663,8 @@ void TypeParseIdentPart(struct ParseState *, struct ValueType *, struct ValueTyp
 void TypeParse(struct ParseState *, struct ValueType **, char **, int *);
 struct ValueType *TypeGetMatching(Picoc *, struct ParseState *, struct ValueType *, enum BaseType, int, const char *, int);
 struct ValueType *TypeCreateOpaqueStruct(Picoc *, struct ParseState *, const char *, int);
+struct ValueType *TypeCopy(Picoc *, Picoc *, struct ValueType *);
+void TypeCopyAll(Picoc *, Picoc *);
 int TypeIsForwardDeclared(struct ParseState *, struct ValueType *);
 
 /* heap.c */
@@ -490,7 +676,12 @@ void HeapUnpopStack(Picoc *, int);
 void HeapPushStackFrame(Picoc *);
 int HeapPopStackFrame(Picoc *);
 void *HeapAllocMem(Picoc *, int);
+void *HeapReallocMem(Picoc *, void *, int);
 void HeapFreeMem(Picoc *, void *);
+int HeapMemSize(void *);
+void HeapAdoptMem(Picoc *, void *);
+/* the following are defined in picoc.h:
+ * void PicocMemoryStats(Picoc *, struct MemoryStats *); */
 
 /* variable.c */
 void VariableInit(Picoc *);
@@ -521,6 +712,7 @@ void VariableScopeEnd(struct ParseState *, int, int);
 
 /* clibrary.c */
 void BasicIOInit(Picoc *);
+void BasicIOCleanup(Picoc *);
 void LibraryInit(Picoc *);
 void LibraryAdd(Picoc *, struct Table *, const char *, struct LibraryFunction *);
 void CLibraryInit(Picoc *);
@@ -530,6 +722,12 @@ void PrintInt(long Num, int, int, int, IOFILE *);
 void PrintStr(const char *, IOFILE *);
 void PrintFP(double, IOFILE *);
 void PrintType(struct ValueType *, IOFILE *);
+char *LibFormatUnsigned(char *, unsigned long);
+int LibFormatFP(char *, double, int);
+const char *LibParseDecimal(const char *, const char *, unsigned long *);
+double LibParseFP(const char *, const char *, const char **);
+double LibStrToFP(const char *, char **);
+long LibStrToLong(const char *, char **);
 void LibPrintf(struct ParseState *, struct Value *, struct Value **, int);
 
 /* platform.c */
@@ -551,9 +749,20 @@ int PlatformGetCharacter();
 void PlatformPutc(unsigned char, union OutputStreamInfo *);
 void PlatformPrintf(IOFILE *, const char *, ...);
 void PlatformVPrintf(IOFILE *, const char *, va_list);
+void PlatformWrite(IOFILE *, const char *, int);
+void PlatformFlush(IOFILE *);
+void PlatformStdoutSink(void *, const char *, int);
 void PlatformExit(Picoc *, int);
+const char *PlatformReadFile(Picoc *, const char *, int *);
 char *PlatformMakeTempName(Picoc *, char *);
 void PlatformLibraryInit(Picoc *);
+void PlatformSampleTimer(Picoc *, int);
+int PlatformCountersOpen(Picoc *);
+void PlatformCountersRead(Picoc *, long long *);
+void PlatformCountersClose(Picoc *);
+
+/* parallel.c */
+void ParallelLex(Picoc *, int, char **, const char **, int *, void **);
 
 /* include.c */
 void IncludeInit(Picoc *);
@@ -568,6 +777,28 @@ void DebugInit(Picoc *);
 void DebugCleanup(Picoc *);
 void DebugCheckStatement(struct ParseState *);
 
+/* profile.c */
+/* the following are defined in picoc.h:
+ * void PicocProfileEnable(Picoc *, const char *);
+ * void PicocProfileSample(Picoc *, const char *);
+ * void PicocProfileLines(Picoc *, const char *);
+ * void PicocProfileTrace(Picoc *, const char *);
+ * void PicocProfileCounters(Picoc *);
+ * int PicocStartupPhases(Picoc *, const struct StartupPhase **);
+ * void PicocProfileReport(Picoc *); */
+void ProfileInit(Picoc *);
+void ProfileCleanup(Picoc *);
+void ProfileEnter(struct ParseState *, const char *, int);
+void ProfileLeave(Picoc *);
+void ProfileSample(struct ParseState *);
+void ProfileCountLine(struct ParseState *);
+void ProfileTraceBegin(Picoc *, const char *, const char *);
+void ProfileTraceEnd(Picoc *);
+void ProfileCountersBegin(Picoc *, long long *);
+void ProfileCountersEnd(Picoc *);
+void ProfilePhaseStart(Picoc *);
+void ProfilePhaseEnd(Picoc *, const char *);
+
 
 /* stdio.c */
 extern const char StdioDefs[];
@@ -26,6 +26,48 @@
 #define TOKEN_DATA_OFFSET 2
 
 #define MAX_CHAR_VALUE 255      /* maximum value which can be represented by a "char" data type */
+#define LEX_BLOCK_DEPTH_MAX 64  /* blocks nested deeper than this aren't given a skip entry */
+#define LEX_ADOPT_CACHE_SIZE 512    /* identifier cache used when taking over another interpreter's tokens */
+#define LEX_FOLDED_SPAN_MAX 65535   /* the most token bytes a folded constant can replace */
+
+/* stored as the value of each '{' token so a skipped block can be jumped over without parsing it.
+ * Offset is from the end of this value to the matching '}', or 0 if the block has to be parsed */
+struct LexBlockSkip
+{
+    int Offset;
+    int Lines;
+};
+
+/* an identifier registered while taking over another interpreter's tokens */
+struct LexAdoptCacheEntry
+{
+    const char *From;
+    char *To;
+};
+
+/* the cached expansion of a call to a macro with parameters. it's followed by a copy of the
+ * call's argument tokens, so a call site whose tokens have since been replaced isn't mistaken
+ * for it, and then by the expanded tokens */
+struct LexMacroExpansion
+{
+    struct MacroDef *MDef;
+    int CallLen;            /* bytes from just after the '(' to just after the ')' */
+};
+
+/* stored as the value of the TokenMacroReturn which ends a macro expansion, so the tokens
+ * carry on from just after the macro call */
+struct LexMacroReturn
+{
+    const unsigned char *Pos;
+    int Lines;              /* line ends within the call */
+};
+
+/* a '{' waiting for its matching '}' while tokenising */
+struct LexOpenBlock
+{
+    int ValueEnd;
+    int Lines;
+};
 
 
 struct ReservedWord
@@ -34,7 +76,7 @@ struct ReservedWord
 	enum LexToken Token;
 };
 
-static struct ReservedWord ReservedWords[] =
+static constexpr struct ReservedWord ReservedWords[] =
 {
 		{ "#define", TokenHashDefine },
 		{ "#else", TokenHashElse },
@@ -77,20 +119,87 @@ static struct ReservedWord ReservedWords[] =
 		{ "while", TokenWhile }
 };
 
+#define NUM_RESERVED_WORDS ((int)(sizeof(ReservedWords) / sizeof(struct ReservedWord)))
+#define RESERVED_WORD_HASH_SIZE 256     /* slots in the reserved word perfect hash */
 
+/* the reserved word perfect hash. the seed is found at compile time and the table maps
+ * each hash value to an index into ReservedWords[], or -1 if no word has that hash */
+struct ReservedWordHash
+{
+    unsigned Seed;
+    signed char Index[RESERVED_WORD_HASH_SIZE];
+};
 
-/* initialise the lexer */
-void LexInit(Picoc *pc)
+static constexpr int LexReservedWordLen(const char *Word)
 {
-    int Count;
+    int Len = 0;
 
-    TableInitTable(&pc->ReservedWordTable, &pc->ReservedWordHashTable[0], sizeof(ReservedWords) / sizeof(struct ReservedWord) * 2, true);
+    while (Word[Len] != '\0')
+        Len++;
 
-    for (Count = 0; Count < (int)(sizeof(ReservedWords) / sizeof(struct ReservedWord)); Count++)
+    return Len;
+}
+
+/* the length of the shortest or the longest reserved word */
+static constexpr int LexReservedWordLenLimit(bool Longest)
+{
+    int Limit = LexReservedWordLen(ReservedWords[0].Word);
+    int Count = 0;
+
+    for (Count = 1; Count < NUM_RESERVED_WORDS; Count++)
     {
-        TableSet(pc, &pc->ReservedWordTable, TableStrRegister(pc, ReservedWords[Count].Word), (struct Value *)&ReservedWords[Count], nullptr, 0, 0);
+        int Len = LexReservedWordLen(ReservedWords[Count].Word);
+
+        if (Longest ? Len > Limit : Len < Limit)
+            Limit = Len;
     }
 
+    return Limit;
+}
+
+/* words of other lengths can't be reserved words, so they aren't hashed */
+static constexpr int ReservedWordLenMin = LexReservedWordLenLimit(false);
+static constexpr int ReservedWordLenMax = LexReservedWordLenLimit(true);
+static_assert(ReservedWordLenMin >= 2, "the reserved word hash looks at the first two characters");
+
+/* hash a word of at least ReservedWordLenMin characters */
+static constexpr unsigned LexReservedWordHash(const char *Word, int Len, unsigned Seed)
+{
+    return ((unsigned char)Word[0] * Seed + (unsigned char)Word[1] * 31 + (unsigned char)Word[Len-1] * 7 + Len) % RESERVED_WORD_HASH_SIZE;
+}
+
+/* find the first seed which gives every reserved word its own slot */
+static constexpr struct ReservedWordHash LexBuildReservedWordHash()
+{
+    struct ReservedWordHash Hash = {};
+    int Count = 0;
+    bool Collision = true;
+
+    for (Hash.Seed = 1; ; Hash.Seed++)
+    {
+        for (Count = 0; Count < RESERVED_WORD_HASH_SIZE; Count++)
+            Hash.Index[Count] = -1;
+
+        Collision = false;
+        for (Count = 0; Count < NUM_RESERVED_WORDS && !Collision; Count++)
+        {
+            unsigned Slot = LexReservedWordHash(ReservedWords[Count].Word, LexReservedWordLen(ReservedWords[Count].Word), Hash.Seed);
+
+            Collision = Hash.Index[Slot] >= 0;
+            Hash.Index[Slot] = Count;
+        }
+
+        if (!Collision)
+            return Hash;
+    }
+}
+
+static constexpr struct ReservedWordHash ReservedWordHash = LexBuildReservedWordHash();
+
+
+/* initialise the lexer */
+void LexInit(Picoc *pc)
+{
     pc->LexValue.Typ = nullptr;
     pc->LexValue.Val = &pc->LexAnyValue;
     pc->LexValue.LValueFrom = nullptr;
@@ -98,40 +207,53 @@ void LexInit(Picoc *pc)
     pc->LexValue.ValOnStack = false;
     pc->LexValue.AnyValOnHeap = false;
     pc->LexValue.IsLValue = false;
+    pc->LexTokenSpace = nullptr;
+    TableInitTable(&pc->FoldedConstantTable, &pc->FoldedConstantHashTable[0], FOLDED_CONSTANT_TABLE_SIZE, true);
+    TableInitTable(&pc->MacroExpansionTable, &pc->MacroExpansionHashTable[0], MACRO_EXPANSION_TABLE_SIZE, true);
+    TableInitTable(&pc->OperandExtentTable, &pc->OperandExtentHashTable[0], OPERAND_EXTENT_TABLE_SIZE, true);
+}
+
+/* free the token buffer of a tokenisation which failed part way through */
+void LexFreeTokenSpace(Picoc *pc)
+{
+    if (pc->LexTokenSpace != nullptr)
+    {
+        HeapFreeMem(pc, pc->LexTokenSpace);
+        pc->LexTokenSpace = nullptr;
+    }
 }
 
 /* deallocate */
 void LexCleanup(Picoc *pc)
 {
-    int Count;
-
     LexInteractiveClear(pc, nullptr);
-
-    for (Count = 0; Count < (int)(sizeof(ReservedWords) / sizeof(struct ReservedWord)); Count++)
-        TableDelete(pc, &pc->ReservedWordTable, TableStrRegister(pc, ReservedWords[Count].Word));
+    LexFreeTokenSpace(pc);
+    VariableTableCleanup(pc, &pc->FoldedConstantTable);
+    VariableTableCleanup(pc, &pc->MacroExpansionTable);
+    VariableTableCleanup(pc, &pc->OperandExtentTable);
 }
 
-/* check if a word is a reserved word - used while scanning */
-enum LexToken LexCheckReservedWord(Picoc *pc, const char *Word)
+/* check if a word is a reserved word - used while scanning, before the word is registered */
+enum LexToken LexCheckReservedWord(const char *Word, int Len)
 {
-    struct Value *val;
+    int Index;
 
-    if (TableGet(&pc->ReservedWordTable, Word, &val, nullptr, nullptr, nullptr))
-        return ((struct ReservedWord *)val)->Token;
-    else
+    if (Len < ReservedWordLenMin || Len > ReservedWordLenMax)
         return TokenNone;
+
+    Index = ReservedWordHash.Index[LexReservedWordHash(Word, Len, ReservedWordHash.Seed)];
+    if (Index >= 0 && strncmp(ReservedWords[Index].Word, Word, Len) == 0 && ReservedWords[Index].Word[Len] == '\0')
+        return ReservedWords[Index].Token;
+
+    return TokenNone;
 }
 
 /* get a numeric literal - used while scanning */
 enum LexToken LexGetNumber(Picoc *pc, struct LexState *Lexer, struct Value *Value)
 {
-    long Result = 0;
+    const char *NumStart = Lexer->Pos;
+    unsigned long Result = 0;
     long Base = 10;
-    enum LexToken ResultToken;
-#ifndef NO_FP
-    double FPResult;
-    double FPDiv;
-#endif
     /* long/unsigned flags */
 #if 0 /* unused for now */
     char IsLong = 0;
@@ -154,81 +276,49 @@ enum LexToken LexGetNumber(Picoc *pc, struct LexState *Lexer, struct Value *Valu
     }
 
     /* get the value */
-    for (; Lexer->Pos != Lexer->End && IS_BASE_DIGIT(*Lexer->Pos, Base); LEXER_INC(Lexer))
-        Result = Result * Base + GET_BASE_DIGIT(*Lexer->Pos);
-
-    if (*Lexer->Pos == 'u' || *Lexer->Pos == 'U')
+    if (Base == 10)
     {
-        LEXER_INC(Lexer);
-        /* IsUnsigned = 1; */
+        const char *DigitsEnd = LibParseDecimal(Lexer->Pos, Lexer->End, &Result);
+        LEXER_INCN(Lexer, DigitsEnd - Lexer->Pos);
     }
-    if (*Lexer->Pos == 'l' || *Lexer->Pos == 'L')
+    else
     {
-        LEXER_INC(Lexer);
-        /* IsLong = 1; */
+        for (; Lexer->Pos != Lexer->End && IS_BASE_DIGIT(*Lexer->Pos, Base); LEXER_INC(Lexer))
+            Result = Result * Base + GET_BASE_DIGIT(*Lexer->Pos);
     }
 
-    Value->Typ = &pc->LongType; /* ignored? */
-    Value->Val->LongInteger = Result;
-
-    ResultToken = TokenIntegerConstant;
-
-    if (Lexer->Pos == Lexer->End)
-        return ResultToken;
-
 #ifndef NO_FP
-    if (Lexer->Pos == Lexer->End)
+    if ((Base == 10 || Base == 8) && Lexer->Pos != Lexer->End && (*Lexer->Pos == '.' || *Lexer->Pos == 'e' || *Lexer->Pos == 'E'))
     {
-        return ResultToken;
-    }
+        /* it's floating point - parse it again from the start as a decimal */
+        const char *FPEnd;
 
-    if (*Lexer->Pos != '.' && *Lexer->Pos != 'e' && *Lexer->Pos != 'E')
-    {
-        return ResultToken;
-    }
+        Value->Typ = &pc->FPType;
+        Value->Val->FP = LibParseFP(NumStart, Lexer->End, &FPEnd);
+        LEXER_INCN(Lexer, FPEnd - Lexer->Pos);
+
+        if (Lexer->Pos != Lexer->End && (*Lexer->Pos == 'f' || *Lexer->Pos == 'F'))
+            LEXER_INC(Lexer);
 
-    Value->Typ = &pc->FPType;
-    FPResult = (double)Result;
+        return TokenFPConstant;
+    }
+#endif
 
-    if (*Lexer->Pos == '.')
+    if (Lexer->Pos != Lexer->End && (*Lexer->Pos == 'u' || *Lexer->Pos == 'U'))
     {
         LEXER_INC(Lexer);
-        for (FPDiv = 1.0/Base; Lexer->Pos != Lexer->End && IS_BASE_DIGIT(*Lexer->Pos, Base); LEXER_INC(Lexer), FPDiv /= (double)Base)
-        {
-            FPResult += GET_BASE_DIGIT(*Lexer->Pos) * FPDiv;
-        }
+        /* IsUnsigned = 1; */
     }
-
-    if (Lexer->Pos != Lexer->End && (*Lexer->Pos == 'e' || *Lexer->Pos == 'E'))
+    if (Lexer->Pos != Lexer->End && (*Lexer->Pos == 'l' || *Lexer->Pos == 'L'))
     {
-        int ExponentSign = 1;
-
         LEXER_INC(Lexer);
-        if (Lexer->Pos != Lexer->End && *Lexer->Pos == '-')
-        {
-            ExponentSign = -1;
-            LEXER_INC(Lexer);
-        }
-
-        Result = 0;
-        while (Lexer->Pos != Lexer->End && IS_BASE_DIGIT(*Lexer->Pos, Base))
-        {
-            Result = Result * Base + GET_BASE_DIGIT(*Lexer->Pos);
-            LEXER_INC(Lexer);
-        }
-
-        FPResult *= pow((double)Base, (double)Result * ExponentSign);
+        /* IsLong = 1; */
     }
 
-    Value->Val->FP = FPResult;
-
-    if (*Lexer->Pos == 'f' || *Lexer->Pos == 'F')
-        LEXER_INC(Lexer);
+    Value->Typ = &pc->LongType; /* ignored? */
+    Value->Val->LongInteger = (long)Result;
 
-    return TokenFPConstant;
-#else
-    return ResultToken;
-#endif
+    return TokenIntegerConstant;
 }
 
 /* get a reserved word or identifier - used while scanning */
@@ -241,10 +331,7 @@ enum LexToken LexGetWord(Picoc *pc, struct LexState *Lexer, struct Value *Value)
         LEXER_INC(Lexer);
     } while (Lexer->Pos != Lexer->End && isCident((int)*Lexer->Pos));
 
-    Value->Typ = nullptr;
-    Value->Val->Identifier = TableStrRegister2(pc, StartPos, Lexer->Pos - StartPos);
-
-    Token = LexCheckReservedWord(pc, Value->Val->Identifier);
+    Token = LexCheckReservedWord(StartPos, Lexer->Pos - StartPos);
     switch (Token)
     {
         case TokenHashInclude: Lexer->Mode = LexModeHashInclude; break;
@@ -255,6 +342,9 @@ enum LexToken LexGetWord(Picoc *pc, struct LexState *Lexer, struct Value *Value)
     if (Token != TokenNone)
         return Token;
 
+    Value->Typ = nullptr;
+    Value->Val->Identifier = TableStrRegister2(pc, StartPos, Lexer->Pos - StartPos);
+
     if (Lexer->Mode == LexModeHashDefineSpace)
         Lexer->Mode = LexModeHashDefineSpaceIdent;
 
@@ -266,7 +356,7 @@ unsigned char LexUnEscapeCharacterConstant(const char **From, const char *End, u
 {
     unsigned char Total = GET_BASE_DIGIT(FirstChar);
     int CCount;
-    for (CCount = 0; IS_BASE_DIGIT(**From, Base) && CCount < 2; CCount++, (*From)++)
+    for (CCount = 0; *From != End && IS_BASE_DIGIT(**From, Base) && CCount < 2; CCount++, (*From)++)
         Total = Total * Base + GET_BASE_DIGIT(**From);
 
     return Total;
@@ -317,6 +407,24 @@ unsigned char LexUnEscapeCharacter(const char **From, const char *End)
         return *(*From)++;
 }
 
+/* register a string literal, sharing an existing copy if there is one */
+char *LexRegisterStringLiteral(Picoc *pc, const char *Str, int Len)
+{
+    char *RegString = TableStrRegister2(pc, Str, Len);
+    struct Value *ArrayValue = VariableStringLiteralGet(pc, RegString);
+
+    if (ArrayValue == nullptr)
+    {
+        /* create and store this string literal */
+        ArrayValue = VariableAllocValueAndData(pc, nullptr, 0, false, nullptr, true);
+        ArrayValue->Typ = pc->CharArrayType;
+        ArrayValue->Val = (union AnyValue *)RegString;
+        VariableStringLiteralDefine(pc, RegString, ArrayValue);
+    }
+
+    return RegString;
+}
+
 /* get a string constant - used while scanning */
 enum LexToken LexGetStringConstant(Picoc *pc, struct LexState *Lexer, struct Value *Value, char EndChar)
 {
@@ -326,7 +434,6 @@ enum LexToken LexGetStringConstant(Picoc *pc, struct LexState *Lexer, struct Val
     char *EscBuf;
     char *EscBufPos;
     char *RegString;
-    struct Value *ArrayValue;
 
     while (Lexer->Pos != Lexer->End && (*Lexer->Pos != EndChar || Escape))
     {
@@ -360,20 +467,10 @@ enum LexToken LexGetStringConstant(Picoc *pc, struct LexState *Lexer, struct Val
     for (EscBufPos = EscBuf, Lexer->Pos = StartPos; Lexer->Pos != EndPos;)
         *EscBufPos++ = LexUnEscapeCharacter(&Lexer->Pos, EndPos);
 
-    /* try to find an existing copy of this string literal */
-    RegString = TableStrRegister2(pc, EscBuf, EscBufPos - EscBuf);
+    RegString = LexRegisterStringLiteral(pc, EscBuf, EscBufPos - EscBuf);
     //FIXME
     //HeapPopStack(pc, EscBuf, EndPos - StartPos);
     HeapPopStack(pc, EndPos - StartPos);
-    ArrayValue = VariableStringLiteralGet(pc, RegString);
-    if (ArrayValue == nullptr)
-    {
-        /* create and store this string literal */
-        ArrayValue = VariableAllocValueAndData(pc, nullptr, 0, false, nullptr, true);
-        ArrayValue->Typ = pc->CharArrayType;
-        ArrayValue->Val = (union AnyValue *)RegString;
-        VariableStringLiteralDefine(pc, RegString, ArrayValue);
-    }
 
     /* create the the pointer for this char* */
     Value->Typ = pc->CharPtrType;
@@ -397,7 +494,7 @@ enum LexToken LexGetCharacterConstant(Picoc *pc, struct LexState *Lexer, struct
 }
 
 /* skip a comment - used while scanning */
-void LexSkipComment(struct LexState *Lexer, char NextChar, enum LexToken *ReturnToken)
+void LexSkipComment(struct LexState *Lexer, char NextChar)
 {
     if (NextChar == '*')
     {
@@ -482,7 +579,7 @@ enum LexToken LexScanGetToken(Picoc *pc, struct LexState *Lexer, struct Value **
             case '+': NEXTIS3('=', TokenAddAssign, '+', TokenIncrement, TokenPlus); break;
             case '-': NEXTIS4('=', TokenSubtractAssign, '>', TokenArrow, '-', TokenDecrement, TokenMinus); break;
             case '*': NEXTIS('=', TokenMultiplyAssign, TokenAsterisk); break;
-            case '/': if (NextChar == '/' || NextChar == '*') { LEXER_INC(Lexer); LexSkipComment(Lexer, NextChar, &GotToken); } else NEXTIS('=', TokenDivideAssign, TokenSlash); break;
+            case '/': if (NextChar == '/' || NextChar == '*') { LEXER_INC(Lexer); LexSkipComment(Lexer, NextChar); } else NEXTIS('=', TokenDivideAssign, TokenSlash); break;
             case '%': NEXTIS('=', TokenModulusAssign, TokenModulus); break;
             case '<': if (Lexer->Mode == LexModeHashInclude) GotToken = LexGetStringConstant(pc, Lexer, *Value, '>'); else { NEXTIS3PLUS('=', TokenLessEqual, '<', TokenShiftLeft, '=', TokenShiftLeftAssign, TokenLessThan); } break;
             case '>': NEXTIS3PLUS('=', TokenGreaterEqual, '>', TokenShiftRight, '=', TokenShiftRightAssign, TokenGreaterThan); break;
@@ -515,35 +612,152 @@ int LexTokenSize(enum LexToken Token)
         case TokenIdentifier: case TokenStringConstant: return sizeof(char *);
         case TokenIntegerConstant: return sizeof(long);
         case TokenCharacterConstant: return sizeof(unsigned char);
+        case TokenLeftBrace: return sizeof(struct LexBlockSkip);
         case TokenFPConstant: return sizeof(double);
+        case TokenConstantRef: return sizeof(struct Value *);
+        case TokenFoldedConstant: return sizeof(struct Value *) + sizeof(unsigned short);
+        case TokenMacroReturn: return sizeof(struct LexMacroReturn);
         default: return 0;
     }
 }
 
-/* produce tokens from the lexer and return a heap buffer with the result - used for scanning */
+/* find the token after the one at Pos */
+static const unsigned char *LexNextToken(const unsigned char *Pos)
+{
+    enum LexToken Token = (enum LexToken)*Pos;
+    unsigned short Span;
+
+    if (Token == TokenFoldedConstant)
+    {
+        memcpy((void *)&Span, (void *)(Pos + TOKEN_DATA_OFFSET + sizeof(struct Value *)), sizeof(Span));
+        return Pos + Span;
+    }
+
+    return Pos + TOKEN_DATA_OFFSET + LexTokenSize(Token);
+}
+
+/* estimate how much space the tokens for some source text will take. each run of identifier
+ * characters is allowed a token with the largest value, and anything else a plain token */
+int LexTokenSpaceEstimate(const char *Pos, const char *End)
+{
+    int Space = TOKEN_DATA_OFFSET;
+
+    for (; Pos < End; Pos++)
+    {
+        if (isCident((unsigned char)*Pos))
+        {
+            while (Pos+1 < End && isCident((unsigned char)Pos[1]))
+                Pos++;
+
+            Space += TOKEN_DATA_OFFSET + sizeof(double);
+        }
+        else if (*Pos == '{')
+            Space += TOKEN_DATA_OFFSET + sizeof(struct LexBlockSkip);
+        else if (*Pos == '\n' || !isspace((unsigned char)*Pos))
+            Space += TOKEN_DATA_OFFSET;
+    }
+
+    return Space;
+}
+
+/* produce tokens from the lexer and return a heap buffer with the result - used for scanning.
+ * the buffer is sized from an estimate and grown if the estimate turns out to be short */
 void *LexTokenise(Picoc *pc, struct LexState *Lexer, int *TokenLen)
 {
     enum LexToken Token;
-    void *HeapMem;
     struct Value *GotValue;
     int MemUsed = 0;
     int ValueSize;
-    int ReserveSpace = (Lexer->End - Lexer->Pos) * 4 + 16;
-    void *TokenSpace = HeapAllocStack(pc, ReserveSpace);
+    int TokenSpaceSize = LexTokenSpaceEstimate(Lexer->Pos, Lexer->End);
+    void *TokenSpace = HeapReallocMem(pc, nullptr, TokenSpaceSize);
     char *TokenPos = (char *)TokenSpace;
     int LastCharacterPos = 0;
+    struct LexOpenBlock OpenBlock[LEX_BLOCK_DEPTH_MAX];
+    struct LexBlockSkip BlockSkip;
+    enum LexToken PrevToken = TokenNone;
+    enum LexToken PrevPrevToken = TokenNone;
+    int BlockDepth = 0;
+    int SkippableDepth = 0;
+    int Lines = 0;
 
     if (TokenSpace == nullptr)
         LexFail(pc, Lexer, "out of memory");
 
+    pc->LexTokenSpace = TokenSpace;
     do
     {
-        /* store the token at the end of the stack area */
+        /* store the token at the end of the buffer */
         Token = LexScanGetToken(pc, Lexer, &GotValue);
 
 #ifdef DEBUG_LEXER
         printf("Token: %02x\n", Token);
 #endif
+        if (MemUsed + TOKEN_DATA_OFFSET + LexTokenSize(Token) > TokenSpaceSize)
+        {
+            /* out of space - grow the buffer */
+            TokenSpaceSize = TokenSpaceSize * 2 + TOKEN_DATA_OFFSET + LexTokenSize(Token);
+            TokenSpace = HeapReallocMem(pc, TokenSpace, TokenSpaceSize);
+            if (TokenSpace == nullptr)
+                LexFail(pc, Lexer, "out of memory");
+
+            pc->LexTokenSpace = TokenSpace;
+            TokenPos = (char *)TokenSpace + MemUsed;
+        }
+
+        switch (Token)
+        {
+            case TokenEndOfLine:
+                Lines++;
+                break;
+
+            case TokenHashDefine: case TokenHashInclude: case TokenHashIf: case TokenHashIfdef:
+            case TokenHashIfndef: case TokenHashElse: case TokenHashEndif:
+                /* these take effect even in skipped code so enclosing blocks have to be parsed */
+                SkippableDepth = BlockDepth;
+                break;
+
+            case TokenLeftBrace:
+                /* so do struct, union and enum definitions */
+                if (PrevToken == TokenStructType || PrevToken == TokenUnionType || PrevToken == TokenEnumType ||
+                        (PrevToken == TokenIdentifier && (PrevPrevToken == TokenStructType || PrevPrevToken == TokenUnionType || PrevPrevToken == TokenEnumType)))
+                    SkippableDepth = BlockDepth;
+
+                if (BlockDepth < LEX_BLOCK_DEPTH_MAX)
+                {
+                    OpenBlock[BlockDepth].ValueEnd = MemUsed + TOKEN_DATA_OFFSET + sizeof(struct LexBlockSkip);
+                    OpenBlock[BlockDepth].Lines = Lines;
+                }
+
+                BlockDepth++;
+                break;
+
+            case TokenRightBrace:
+                if (BlockDepth == 0)
+                    break;
+
+                /* fill in the skip entry of the matching '{' */
+                BlockDepth--;
+                if (BlockDepth < LEX_BLOCK_DEPTH_MAX && BlockDepth >= SkippableDepth)
+                {
+                    BlockSkip.Offset = MemUsed - OpenBlock[BlockDepth].ValueEnd;
+                    BlockSkip.Lines = Lines - OpenBlock[BlockDepth].Lines;
+                    memcpy((void *)((char *)TokenSpace + OpenBlock[BlockDepth].ValueEnd - sizeof(struct LexBlockSkip)), (void *)&BlockSkip, sizeof(struct LexBlockSkip));
+                }
+
+                if (SkippableDepth > BlockDepth)
+                    SkippableDepth = BlockDepth;
+                break;
+
+            default:
+                break;
+        }
+
+        if (Token != TokenEndOfLine)
+        {
+            PrevPrevToken = PrevToken;
+            PrevToken = Token;
+        }
+
         *(unsigned char *)TokenPos = Token;
         TokenPos++;
         MemUsed++;
@@ -553,7 +767,14 @@ void *LexTokenise(Picoc *pc, struct LexState *Lexer, int *TokenLen)
         MemUsed++;
 
         ValueSize = LexTokenSize(Token);
-        if (ValueSize > 0)
+        if (Token == TokenLeftBrace)
+        {
+            /* the skip entry is filled in when we find the matching '}' */
+            memset((void *)TokenPos, '\0', ValueSize);
+            TokenPos += ValueSize;
+            MemUsed += ValueSize;
+        }
+        else if (ValueSize > 0)
         {
             /* store a value as well */
             memcpy((void *)TokenPos, (void *)GotValue->Val, ValueSize);
@@ -565,34 +786,118 @@ void *LexTokenise(Picoc *pc, struct LexState *Lexer, int *TokenLen)
 
     } while (Token != TokenEOF);
 
-    HeapMem = HeapAllocMem(pc, MemUsed);
-    if (HeapMem == nullptr)
-        LexFail(pc, Lexer, "out of memory");
-
-    assert(ReserveSpace >= MemUsed);
-    memcpy(HeapMem, TokenSpace, MemUsed);
-    //FIXME
-    //HeapPopStack(pc, TokenSpace, ReserveSpace);
-    HeapPopStack(pc, ReserveSpace);
 #ifdef DEBUG_LEXER
     {
         int Count;
         printf("Tokens: ");
         for (Count = 0; Count < MemUsed; Count++)
-            printf("%02x ", *((unsigned char *)HeapMem+Count));
+            printf("%02x ", *((unsigned char *)TokenSpace+Count));
         printf("\n");
     }
 #endif
     if (TokenLen)
         *TokenLen = MemUsed;
 
-    return HeapMem;
+    pc->LexTokenSpace = nullptr;
+    return TokenSpace;
+}
+
+/* register the string of an identifier or string literal token which came from another
+ * interpreter in pc's tables and point the token at pc's copy. each distinct identifier is
+ * usually only looked up once thanks to a small cache */
+static void LexAdoptTokenString(Picoc *pc, struct LexAdoptCacheEntry *Cache, unsigned char *Pos)
+{
+    const char *From;
+    char *To;
+    int CacheEntry;
+
+    memcpy((void *)&From, (void *)(Pos + TOKEN_DATA_OFFSET), sizeof(From));
+    CacheEntry = ((unsigned long)From / sizeof(ALIGN_TYPE)) % LEX_ADOPT_CACHE_SIZE;
+    if (*Pos == TokenStringConstant)
+        To = LexRegisterStringLiteral(pc, From, strlen(From));
+    else if (Cache[CacheEntry].From == From)
+        To = Cache[CacheEntry].To;
+    else
+    {
+        To = TableStrRegister(pc, From);
+        Cache[CacheEntry].From = From;
+        Cache[CacheEntry].To = To;
+    }
+
+    memcpy((void *)(Pos + TOKEN_DATA_OFFSET), (void *)&To, sizeof(To));
+}
+
+/* take over tokens which were produced by another interpreter's lexer by registering their
+ * identifiers and string literals in this interpreter's tables. the other interpreter must
+ * still exist */
+void LexAdoptTokens(Picoc *pc, void *Tokens)
+{
+    struct LexAdoptCacheEntry Cache[LEX_ADOPT_CACHE_SIZE];
+    unsigned char *Pos = (unsigned char *)Tokens;
+    enum LexToken Token;
+
+    memset((void *)&Cache[0], '\0', sizeof(Cache));
+    while ((Token = (enum LexToken)*Pos) != TokenEOF)
+    {
+        if (Token == TokenIdentifier || Token == TokenStringConstant)
+            LexAdoptTokenString(pc, &Cache[0], Pos);
+
+        Pos += TOKEN_DATA_OFFSET + LexTokenSize(Token);
+    }
+
+    HeapAdoptMem(pc, Tokens);
+}
+
+/* copy a function or macro body belonging to pc into the interpreter To. identifiers and string
+ * literals are registered in To and folded constants get values of To's at their new positions,
+ * so the copy doesn't refer to anything of pc's */
+void *LexCopyTokensTo(Picoc *pc, Picoc *To, const unsigned char *Tokens)
+{
+    struct LexAdoptCacheEntry Cache[LEX_ADOPT_CACHE_SIZE];
+    const unsigned char *Pos;
+    unsigned char *NewTokens;
+    unsigned char *NewPos;
+    struct Value *Constant;
+    struct Value *Folded;
+    int MemSize;
+
+    for (Pos = Tokens; *Pos != TokenEndOfFunction; Pos = LexNextToken(Pos))
+    {}
+
+    MemSize = Pos - Tokens + TOKEN_DATA_OFFSET;
+    NewTokens = (unsigned char *)VariableAlloc(To, nullptr, MemSize, true);
+    memcpy((void *)NewTokens, (void *)Tokens, MemSize);
+
+    memset((void *)&Cache[0], '\0', sizeof(Cache));
+    for (NewPos = NewTokens; *NewPos != TokenEndOfFunction; NewPos = (unsigned char *)LexNextToken(NewPos))
+    {
+        switch (*NewPos)
+        {
+            case TokenIdentifier: case TokenStringConstant:
+                LexAdoptTokenString(To, &Cache[0], NewPos);
+                break;
+
+            case TokenConstantRef: case TokenFoldedConstant:
+                memcpy((void *)&Constant, (void *)(NewPos + TOKEN_DATA_OFFSET), sizeof(Constant));
+                Folded = VariableAllocValueAndCopy(To, nullptr, Constant, true);
+                Folded->Typ = TypeCopy(pc, To, Constant->Typ);
+                TableSet(To, &To->FoldedConstantTable, (char *)NewPos, Folded, nullptr, 0, 0);
+                memcpy((void *)(NewPos + TOKEN_DATA_OFFSET), (void *)&Folded, sizeof(Folded));
+                break;
+
+            default:
+                break;
+        }
+    }
+
+    return NewTokens;
 }
 
 /* lexically analyse some source text */
 void *LexAnalyse(Picoc *pc, const char *FileName, const char *Source, int SourceLen, int *TokenLen)
 {
 	struct LexState Lexer;
+	void *Tokens;
 
 	Lexer.Pos = Source;
 	Lexer.End = Source + SourceLen;
@@ -603,7 +908,21 @@ void *LexAnalyse(Picoc *pc, const char *FileName, const char *Source, int Source
 	Lexer.CharacterPos = 1;
 	Lexer.SourceText = Source;
 
-	return LexTokenise(pc, &Lexer, TokenLen);
+	/* ignore "#!/path/to/picoc" at the start of a script */
+	if (SourceLen >= 2 && Source[0] == '#' && Source[1] == '!')
+	{
+		while (Lexer.Pos < Lexer.End && *Lexer.Pos != '\r' && *Lexer.Pos != '\n')
+			Lexer.Pos++;
+	}
+
+	if (pc->TraceFileName != nullptr)
+		ProfileTraceBegin(pc, TableStrRegister(pc, FileName), "lex");
+
+	Tokens = LexTokenise(pc, &Lexer, TokenLen);
+	if (pc->TraceFileName != nullptr)
+		ProfileTraceEnd(pc);
+
+	return Tokens;
 }
 
 /* prepare to parse a pre-tokenised buffer */
@@ -620,6 +939,31 @@ void LexInitParser(struct ParseState *Parser, Picoc *pc, const char *SourceText,
     Parser->CharacterPos = 0;
     Parser->SourceText = SourceText;
     Parser->DebugMode = EnableDebugger;
+    Parser->ScopeID = 0;
+}
+
+/* get the value of a folded constant as if it was a literal */
+static enum LexToken LexGetConstant(struct ParseState *Parser, struct Value **Value, int IncPos)
+{
+    Picoc *pc = Parser->pc;
+    struct Value *Constant;
+
+    memcpy((void *)&Constant, (void *)(Parser->Pos + TOKEN_DATA_OFFSET), sizeof(Constant));
+    if (Value != nullptr)
+    {
+        pc->LexValue.Typ = Constant->Typ;
+        memcpy((void *)pc->LexValue.Val, (void *)Constant->Val, TypeSizeValue(Constant, true));
+        pc->LexValue.ValOnHeap = false;
+        pc->LexValue.ValOnStack = false;
+        pc->LexValue.IsLValue = false;
+        pc->LexValue.LValueFrom = nullptr;
+        *Value = &pc->LexValue;
+    }
+
+    if (IncPos)
+        Parser->Pos = LexNextToken(Parser->Pos);
+
+    return IS_FP(Constant) ? TokenFPConstant : TokenIntegerConstant;
 }
 
 /* get the next token, without pre-processing */
@@ -636,6 +980,16 @@ enum LexToken LexGetRawToken(struct ParseState *Parser, struct Value **Value, in
         if (Parser->Pos == nullptr && pc->InteractiveHead != nullptr)
             Parser->Pos = pc->InteractiveHead->Tokens;
 
+        /* at the end of a macro expansion carry on from just after the macro call */
+        while (Parser->Pos != nullptr && *Parser->Pos == TokenMacroReturn)
+        {
+            struct LexMacroReturn Return;
+
+            memcpy((void *)&Return, (void *)(Parser->Pos + TOKEN_DATA_OFFSET), sizeof(Return));
+            Parser->Pos = Return.Pos;
+            Parser->Line += Return.Lines;
+        }
+
         if (Parser->FileName != pc->StrEmpty || pc->InteractiveHead != nullptr)
         {
             /* skip leading newlines */
@@ -665,6 +1019,7 @@ enum LexToken LexGetRawToken(struct ParseState *Parser, struct Value **Value, in
                 else
                     Prompt = (char*)INTERACTIVE_PROMPT_LINE;
 
+                PlatformFlush(pc->CStdOut);
                 if (PlatformGetLine(&LineBuffer[0], LINEBUFFER_MAX, Prompt) == nullptr)
                     return TokenEOF;
 
@@ -708,6 +1063,9 @@ enum LexToken LexGetRawToken(struct ParseState *Parser, struct Value **Value, in
     } while ((Parser->FileName == pc->StrEmpty && Token == TokenEOF) || Token == TokenEndOfLine);
 
     Parser->CharacterPos = *((unsigned char *)Parser->Pos + 1);
+    if (Token == TokenConstantRef || Token == TokenFoldedConstant)
+        return LexGetConstant(Parser, Value, IncPos);
+
     ValueSize = LexTokenSize(Token);
     if (ValueSize > 0)
     {
@@ -873,7 +1231,8 @@ void LexPrintToken(enum LexToken Token)
         /* 0x52 */ "HashDefine", "HashInclude", "HashIf", "HashIfdef", "HashIfndef", "HashElse", "HashEndif",
         /* 0x59 */ "New", "Delete",
         /* 0x5b */ "OpenMacroBracket",
-        /* 0x5c */ "EOF", "EndOfLine", "EndOfFunction"
+        /* 0x5c */ "EOF", "EndOfLine", "EndOfFunction",
+        /* 0x5f */ "ConstantRef", "FoldedConstant", "MacroReturn"
     };
     printf("{%s}", TokenNames[Token]);
 }
@@ -911,6 +1270,273 @@ enum LexToken LexGetToken(struct ParseState *Parser, struct Value **Value, int I
     return Token;
 }
 
+/* jump from just after a '{' to its matching '}' without parsing the tokens in between.
+ * returns false if the block has no skip entry and has to be parsed instead */
+int LexSkipBlock(struct ParseState *Parser)
+{
+    struct LexBlockSkip BlockSkip;
+
+    memcpy((void *)&BlockSkip, (void *)(Parser->Pos - sizeof(struct LexBlockSkip)), sizeof(struct LexBlockSkip));
+    if (BlockSkip.Offset == 0)
+        return false;
+
+    Parser->Pos += BlockSkip.Offset;
+    Parser->Line += BlockSkip.Lines;
+    return true;
+}
+
+/* find where the token read from Pos starts, past any line ends */
+const unsigned char *LexTokenStart(const unsigned char *Pos)
+{
+    if (Pos == nullptr)
+        return nullptr;
+
+    while (*Pos == TokenEndOfLine)
+        Pos += TOKEN_DATA_OFFSET;
+
+    return Pos;
+}
+
+/* the line the parser's next token is on, which is after the parser's line if there are line ends before it */
+int LexNextTokenLine(struct ParseState *Parser)
+{
+    const unsigned char *Pos = (const unsigned char *)Parser->Pos;
+    int Line = Parser->Line;
+
+    while (Pos != nullptr && *Pos == TokenEndOfLine)
+    {
+        Pos += TOKEN_DATA_OFFSET;
+        Line++;
+    }
+
+    return Line;
+}
+
+/* check if the tokens at Pos are a single constant, such as a macro body which is a literal
+ * or which has been folded */
+int LexIsConstant(const unsigned char *Pos)
+{
+    Pos = LexTokenStart(Pos);
+    switch (*Pos)
+    {
+        case TokenIntegerConstant: case TokenFPConstant: case TokenCharacterConstant:
+        case TokenConstantRef: case TokenFoldedConstant:
+            return *LexTokenStart(LexNextToken(Pos)) == TokenEndOfFunction;
+
+        default:
+            return false;
+    }
+}
+
+/* replace the tokens from Start to End, which have just been evaluated to the constant value
+ * Constant, with a single constant token. the tokens must be an expression on a single line.
+ * returns false if they can't be replaced.
+ * an expression becomes a TokenFoldedConstant holding a pointer to its value followed by the
+ * length of the tokens it replaces, which are then jumped over. a constant identifier on its
+ * own becomes a TokenConstantRef holding only the pointer, since that's all that fits in its place */
+int LexFoldConstant(struct ParseState *Parser, const unsigned char *Start, const unsigned char *End, struct Value *Constant)
+{
+    Picoc *pc = Parser->pc;
+    const unsigned char *Pos;
+    unsigned char *Token;
+    struct Value *Folded;
+    unsigned short Span;
+    int NumTokens = 0;
+
+    if (Start == nullptr || End <= Start || End - Start > LEX_FOLDED_SPAN_MAX)
+        return false;
+
+    for (Pos = Start; Pos < End; Pos = LexNextToken(Pos), NumTokens++)
+    {
+        enum LexToken PosToken = (enum LexToken)*Pos;
+
+        if (!( (PosToken > TokenComma && PosToken <= TokenCloseBracket) ||
+               (PosToken >= TokenIdentifier && PosToken <= TokenCharacterConstant && PosToken != TokenStringConstant) ||
+               PosToken == TokenConstantRef || PosToken == TokenFoldedConstant ))
+            return false;
+    }
+
+    if (Pos != End)
+        return false;
+
+    if (NumTokens == 1 ? (*Start != TokenIdentifier) : (End - Start < (int)(TOKEN_DATA_OFFSET + LexTokenSize(TokenFoldedConstant))))
+        return false;
+
+    Folded = VariableAllocValueAndCopy(pc, Parser, Constant, true);
+    Folded->IsLValue = false;
+    Folded->LValueFrom = nullptr;
+
+    /* the table owns the value. tokens can be freed and their memory reused, so replace any earlier value */
+    if (!TableSet(pc, &pc->FoldedConstantTable, (char *)Start, Folded, nullptr, 0, 0))
+    {
+        VariableFree(pc, TableDelete(pc, &pc->FoldedConstantTable, (const char *)Start));
+        TableSet(pc, &pc->FoldedConstantTable, (char *)Start, Folded, nullptr, 0, 0);
+    }
+
+    Token = (unsigned char *)Start;
+    memcpy((void *)(Token + TOKEN_DATA_OFFSET), (void *)&Folded, sizeof(Folded));
+    if (NumTokens == 1)
+        *Token = TokenConstantRef;
+    else
+    {
+        Span = End - Start;
+        memcpy((void *)(Token + TOKEN_DATA_OFFSET + sizeof(Folded)), (void *)&Span, sizeof(Span));
+        *Token = TokenFoldedConstant;
+    }
+
+    return true;
+}
+
+/* copy the tokens of a macro argument, leaving out line ends. with To == nullptr just measure them */
+static int LexCopyMacroArg(unsigned char *To, const unsigned char *From, const unsigned char *End)
+{
+    int Size = 0;
+    const unsigned char *Next;
+
+    for (; From < End; From = Next)
+    {
+        Next = LexNextToken(From);
+        if (*From != TokenEndOfLine)
+        {
+            if (To != nullptr)
+                memcpy((void *)&To[Size], (void *)From, Next - From);
+
+            Size += Next - From;
+        }
+    }
+
+    return Size;
+}
+
+/* substitute the arguments for the parameters in a copy of a macro body. with To == nullptr just measure it */
+static int LexSubstituteMacroArgs(unsigned char *To, struct MacroDef *MDef, const unsigned char **ArgStart, const unsigned char **ArgEnd)
+{
+    const unsigned char *Pos;
+    const unsigned char *Next;
+    const char *Ident;
+    int Size = 0;
+    int Count;
+
+    for (Pos = MDef->Body.Pos; *Pos != TokenEndOfFunction; Pos = Next)
+    {
+        Next = LexNextToken(Pos);
+        Count = MDef->NumParams;
+        if (*Pos == TokenIdentifier)
+        {
+            memcpy((void *)&Ident, (void *)(Pos + TOKEN_DATA_OFFSET), sizeof(Ident));
+            for (Count = 0; Count < MDef->NumParams && MDef->ParamName[Count] != Ident; Count++)
+            {}
+        }
+
+        if (Count < MDef->NumParams)
+            Size += LexCopyMacroArg((To != nullptr) ? &To[Size] : nullptr, ArgStart[Count], ArgEnd[Count]);
+        else
+        {
+            if (To != nullptr)
+                memcpy((void *)&To[Size], (void *)Pos, Next - Pos);
+
+            Size += Next - Pos;
+        }
+    }
+
+    return Size;
+}
+
+/* expand a call to a macro with parameters, where the parser is just after the call's '('.
+ * returns the macro body with the argument tokens substituted for its parameters, ending in a
+ * TokenMacroReturn which carries on from just after the call's ')'. the parser can read the
+ * expansion in place of the call, so it's parsed as part of the surrounding tokens just like
+ * C's textual substitution. expansions are cached by call site so each is only built once */
+const unsigned char *LexExpandMacro(struct ParseState *Parser, struct MacroDef *MDef, const char *MacroName)
+{
+    Picoc *pc = Parser->pc;
+    struct Value *CacheValue;
+    struct LexMacroExpansion *Expansion;
+    struct LexMacroReturn Return;
+    const unsigned char *ArgStart[PARAMETER_MAX];
+    const unsigned char *ArgEnd[PARAMETER_MAX];
+    const unsigned char *Pos = Parser->Pos;
+    unsigned char *Tokens;
+    int NumArgs = 0;
+    int Depth = 0;
+    int Lines = 0;
+    int Size;
+
+    if (TableGet(&pc->MacroExpansionTable, (const char *)Parser->Pos, &CacheValue, nullptr, nullptr, nullptr))
+    {
+        Expansion = (struct LexMacroExpansion *)CacheValue->Val;
+        if (Expansion->MDef == MDef && memcmp((void *)((char *)Expansion + sizeof(struct LexMacroExpansion)), (void *)Parser->Pos, Expansion->CallLen) == 0)
+            return (unsigned char *)Expansion + sizeof(struct LexMacroExpansion) + Expansion->CallLen;
+
+        /* the tokens at this position have been freed and reused for something else */
+        VariableFree(pc, TableDelete(pc, &pc->MacroExpansionTable, (const char *)Parser->Pos));
+    }
+
+    /* find the arguments, which are separated by commas outside any brackets */
+    ArgStart[0] = Pos;
+    while (true)
+    {
+        enum LexToken Token = (enum LexToken)*Pos;
+
+        if (Depth == 0 && (Token == TokenComma || Token == TokenCloseBracket))
+        {
+            /* "()" is a call with no arguments rather than one empty argument */
+            if (Token == TokenComma || Pos != ArgStart[0] || MDef->NumParams > 0)
+            {
+                if (NumArgs >= MDef->NumParams)
+                    ProgramFail(Parser, "too many arguments to %s()", MacroName);
+
+                ArgEnd[NumArgs++] = Pos;
+            }
+
+            Pos = LexNextToken(Pos);
+            if (Token == TokenCloseBracket)
+                break;
+
+            if (NumArgs < PARAMETER_MAX)
+                ArgStart[NumArgs] = Pos;
+
+            continue;
+        }
+
+        switch (Token)
+        {
+            case TokenOpenBracket: case TokenOpenMacroBracket: Depth++; break;
+            case TokenCloseBracket: Depth--; break;
+            case TokenEndOfLine: Lines++; break;
+            case TokenEOF: case TokenEndOfFunction: ProgramFail(Parser, "brackets not closed"); break;
+            default: break;
+        }
+
+        Pos = LexNextToken(Pos);
+    }
+
+    if (NumArgs < MDef->NumParams)
+        ProgramFail(Parser, "not enough arguments to '%s'", MacroName);
+
+    /* cache the call's tokens and the expansion together */
+    Size = LexSubstituteMacroArgs(nullptr, MDef, ArgStart, ArgEnd);
+    CacheValue = VariableAllocValueAndData(pc, Parser, sizeof(struct LexMacroExpansion) + (Pos - Parser->Pos) + Size + TOKEN_DATA_OFFSET + sizeof(struct LexMacroReturn) + TOKEN_DATA_OFFSET, false, nullptr, true);
+    CacheValue->Typ = &pc->VoidType;
+    Expansion = (struct LexMacroExpansion *)CacheValue->Val;
+    Expansion->MDef = MDef;
+    Expansion->CallLen = Pos - Parser->Pos;
+    memcpy((void *)((char *)Expansion + sizeof(struct LexMacroExpansion)), (void *)Parser->Pos, Expansion->CallLen);
+
+    Tokens = (unsigned char *)Expansion + sizeof(struct LexMacroExpansion) + Expansion->CallLen;
+    LexSubstituteMacroArgs(Tokens, MDef, ArgStart, ArgEnd);
+    Return.Pos = Pos;
+    Return.Lines = Lines;
+    Tokens[Size] = TokenMacroReturn;
+    Tokens[Size+1] = 0;
+    memcpy((void *)&Tokens[Size + TOKEN_DATA_OFFSET], (void *)&Return, sizeof(Return));
+    Tokens[Size + TOKEN_DATA_OFFSET + sizeof(Return)] = TokenEndOfFunction;
+    Tokens[Size + TOKEN_DATA_OFFSET + sizeof(Return) + 1] = 0;
+
+    TableSet(pc, &pc->MacroExpansionTable, (char *)Parser->Pos, CacheValue, nullptr, 0, 0);
+    return Tokens;
+}
+
 /* take a quick peek at the next token, skipping any pre-processing */
 enum LexToken LexRawPeekToken(struct ParseState *Parser)
 {
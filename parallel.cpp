@@ -0,0 +1,490 @@
+/* picoc parallel map - runs a function over many inputs on clones of a loaded
+ * interpreter. each clone is a complete, independent picoc so the clones can
+ * run on separate threads without sharing any interpreter state. the same
+ * approach is used to tokenise several source files at once */
+
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <map>
+
+#include "picoc.h"
+#include "interpreter.h"
+
+#define PARALLEL_CHUNKS_PER_WORKER 8        /* split the work finer than the number of workers so it can be stolen */
+
+/* a worker's share of the work. the worker takes chunks from the front and other workers steal from the back */
+struct ParallelWorker
+{
+    Picoc *Clone;
+    std::mutex Lock;
+    int NextChunk;
+    int EndChunk;
+};
+
+/* a parallel map in progress */
+struct ParallelJob
+{
+    const char *FuncName;
+    int NumParams;
+    int NumCalls;
+    int ChunkSize;
+    union AnyValue *Args;
+    union AnyValue *Results;
+    struct ParallelWorker *Workers;
+    int NumWorkers;
+    std::atomic<bool> Failed;
+    Picoc *pc;                      /* the clones' output is passed on to this interpreter's */
+    std::mutex OutputLock;
+};
+
+/* where some of pc's data was copied to in a clone, by where it was in pc */
+struct ParallelCopiedData
+{
+    int Size;
+    char *NewData;
+    struct ValueType *Typ;          /* the type of a copied global, for relocating pointers in it, or nullptr */
+};
+
+typedef std::map<const char *, struct ParallelCopiedData> ParallelCopiedMap;
+
+/* source files being tokenised in parallel */
+struct ParallelLexJob
+{
+    char **FileNames;
+    const char **Sources;
+    int *SourceLens;
+    void **Tokens;
+    int NumFiles;
+    std::atomic<int> NextFile;
+};
+
+/* find where a pointer into pc's data points in the clone. pointers to anything else are kept */
+static void *ParallelClonePointer(Picoc *pc, Picoc *Clone, ParallelCopiedMap &Copied, void *Pointer)
+{
+    const char *OldPointer = (const char *)Pointer;
+    ParallelCopiedMap::iterator Found = Copied.upper_bound(OldPointer);
+
+    if (Found != Copied.begin())
+    {
+        --Found;
+        if (OldPointer <= Found->first + Found->second.Size)
+            return Found->second.NewData + (OldPointer - Found->first);
+    }
+
+    if (OldPointer >= (char *)pc && OldPointer < (char *)(pc + 1))
+        return (char *)Clone + (OldPointer - (char *)pc);
+
+    return Pointer;
+}
+
+/* point the pointers in some data copied to the clone at the clone's copies of what they pointed to */
+static void ParallelRelocate(Picoc *pc, Picoc *Clone, ParallelCopiedMap &Copied, char *Data, struct ValueType *Typ)
+{
+    struct TableEntry *Entry;
+    void *Pointer;
+    int Count;
+
+    switch (Typ->Base)
+    {
+        case TypePointer:
+            memcpy((void *)&Pointer, (void *)Data, sizeof(Pointer));
+            Pointer = ParallelClonePointer(pc, Clone, Copied, Pointer);
+            memcpy((void *)Data, (void *)&Pointer, sizeof(Pointer));
+            break;
+
+        case TypeArray:
+            switch (Typ->FromType->Base)
+            {
+                case TypePointer: case TypeArray: case TypeStruct: case TypeUnion:
+                    for (Count = 0; Count < Typ->ArraySize; Count++)
+                        ParallelRelocate(pc, Clone, Copied, Data + Count * Typ->FromType->Sizeof, Typ->FromType);
+                    break;
+
+                default:
+                    break;
+            }
+            break;
+
+        case TypeStruct: case TypeUnion:
+            for (Count = 0; Typ->Members != nullptr && Count < Typ->Members->Size; Count++)
+            {
+                for (Entry = Typ->Members->HashTable[Count]; Entry != nullptr; Entry = Entry->Next)
+                    ParallelRelocate(pc, Clone, Copied, Data + Entry->p.v.Val->Val->Integer, Entry->p.v.Val->Typ);
+            }
+            break;
+
+        default:
+            break;
+    }
+}
+
+/* give the clone its own copy of a function or macro body */
+static void ParallelCloneBody(Picoc *pc, Picoc *Clone, struct ParseState *Body)
+{
+    Body->pc = Clone;
+    Body->Pos = (const unsigned char *)LexCopyTokensTo(pc, Clone, Body->Pos);
+    Body->FileName = TableStrRegister(Clone, Body->FileName);
+}
+
+/* copy one of pc's global values to the clone. the data of variables is noted in Copied so
+ * pointers to it can be relocated once everything has been copied */
+static struct Value *ParallelCloneValue(Picoc *pc, Picoc *Clone, ParallelCopiedMap &Copied, struct Value *Val)
+{
+    struct Value *NewValue;
+    int Size;
+    int Count;
+
+    if (Val->Typ == &pc->FunctionType)
+    {
+        struct FuncDef *FuncDef = &Val->Val->FuncDef;
+        struct FuncDef *NewFuncDef;
+
+        NewValue = VariableAllocValueAndData(Clone, nullptr, sizeof(struct FuncDef) + sizeof(struct ValueType *) * FuncDef->NumParams + sizeof(const char *) * FuncDef->NumParams, false, nullptr, true);
+        NewFuncDef = &NewValue->Val->FuncDef;
+        *NewFuncDef = *FuncDef;
+        NewFuncDef->ReturnType = TypeCopy(pc, Clone, FuncDef->ReturnType);
+        NewFuncDef->ParamType = (struct ValueType **)((char *)NewValue->Val + sizeof(struct FuncDef));
+        NewFuncDef->ParamName = (char **)((char *)NewFuncDef->ParamType + sizeof(struct ValueType *) * FuncDef->NumParams);
+        for (Count = 0; Count < FuncDef->NumParams; Count++)
+        {
+            NewFuncDef->ParamType[Count] = TypeCopy(pc, Clone, FuncDef->ParamType[Count]);
+            NewFuncDef->ParamName[Count] = TableStrRegister(Clone, FuncDef->ParamName[Count]);
+        }
+
+        if (FuncDef->Intrinsic == nullptr && FuncDef->Body.Pos != nullptr)
+            ParallelCloneBody(pc, Clone, &NewFuncDef->Body);
+    }
+    else if (Val->Typ == &pc->MacroType)
+    {
+        struct MacroDef *MacroDef = &Val->Val->MacroDef;
+        struct MacroDef *NewMacroDef;
+
+        NewValue = VariableAllocValueAndData(Clone, nullptr, sizeof(struct MacroDef) + sizeof(const char *) * MacroDef->NumParams, false, nullptr, true);
+        NewMacroDef = &NewValue->Val->MacroDef;
+        *NewMacroDef = *MacroDef;
+        NewMacroDef->ParamName = (char **)((char *)NewValue->Val + sizeof(struct MacroDef));
+        for (Count = 0; Count < MacroDef->NumParams; Count++)
+            NewMacroDef->ParamName[Count] = TableStrRegister(Clone, MacroDef->ParamName[Count]);
+
+        ParallelCloneBody(pc, Clone, &NewMacroDef->Body);
+    }
+    else if (Val->AnyValOnHeap || (char *)Val->Val == (char *)Val + MEM_ALIGN(sizeof(struct Value)))
+    {
+        /* a variable which owns its data. constants may only have room for their compact size */
+        Size = TypeSizeValue(Val, true);
+        NewValue = VariableAllocValueAndData(Clone, nullptr, TypeSizeValue(Val, false), Val->IsLValue, nullptr, true);
+        memcpy((void *)NewValue->Val, (void *)Val->Val, Size);
+        NewValue->IsConstant = Val->IsConstant;
+        if (Val->Typ == &pc->TypeType)
+            NewValue->Val->Typ = TypeCopy(pc, Clone, Val->Val->Typ);
+        else
+            Copied[(const char *)Val->Val] = { Size, (char *)NewValue->Val, TypeCopy(pc, Clone, Val->Typ) };
+    }
+    else
+    {
+        /* a platform variable whose data is somewhere else */
+        NewValue = VariableAllocValueAndData(Clone, nullptr, 0, Val->IsLValue, nullptr, true);
+        NewValue->Val = (union AnyValue *)ParallelClonePointer(pc, Clone, Copied, Val->Val);
+    }
+
+    NewValue->Typ = TypeCopy(pc, Clone, Val->Typ);
+    return NewValue;
+}
+
+/* copy everything pc has loaded into Clone, which must already be initialised with
+ * PicocInitialise() and have an exit point set. the clone includes the same system
+ * headers and then gets its own copies of pc's types, string literals, global variables,
+ * and function and macro bodies, without parsing any source again. pointers between
+ * copied globals are relocated. the copies of function bodies refer to pc's source text
+ * for error messages, so pc must outlive the clone */
+void PicocClone(Picoc *pc, Picoc *Clone)
+{
+    ParallelCopiedMap Copied;
+    ParallelCopiedMap::iterator Data;
+    struct TableEntry *Entry;
+    char *Key;
+    int Count;
+#ifndef NO_HASH_INCLUDE
+    struct IncludeLibrary *Include;
+    struct IncludeLibrary *CloneInclude;
+
+    for (Include = pc->IncludeLibList; Include != nullptr; Include = Include->NextLib)
+    {
+        if (!VariableDefined(pc, Include->IncludeName))
+            continue;
+
+        /* the host may have registered libraries of its own with pc */
+        Key = TableStrRegister(Clone, Include->IncludeName);
+        for (CloneInclude = Clone->IncludeLibList; CloneInclude != nullptr && CloneInclude->IncludeName != Key; CloneInclude = CloneInclude->NextLib)
+        {}
+
+        if (CloneInclude == nullptr)
+            IncludeRegister(Clone, Key, Include->SetupFunction, Include->FuncList, Include->SetupCSource);
+
+        IncludeFile(Clone, Key);
+    }
+#endif
+
+    TypeCopyAll(pc, Clone);
+
+    for (Count = 0; Count < pc->StringLiteralTable.Size; Count++)
+    {
+        for (Entry = pc->StringLiteralTable.HashTable[Count]; Entry != nullptr; Entry = Entry->Next)
+            Copied[Entry->p.v.Key] = { (int)strlen(Entry->p.v.Key) + 1, LexRegisterStringLiteral(Clone, Entry->p.v.Key, strlen(Entry->p.v.Key)), nullptr };
+    }
+
+    for (Count = 0; Count < pc->GlobalTable.Size; Count++)
+    {
+        for (Entry = pc->GlobalTable.HashTable[Count]; Entry != nullptr; Entry = Entry->Next)
+        {
+            Key = TableStrRegister(Clone, Entry->p.v.Key);
+            if (VariableDefined(Clone, Key))
+                continue;       /* the clone made its own when it included the system headers */
+
+            TableSet(Clone, &Clone->GlobalTable, Key, ParallelCloneValue(pc, Clone, Copied, Entry->p.v.Val), (Entry->DeclFileName != nullptr) ? TableStrRegister(Clone, Entry->DeclFileName) : nullptr, Entry->DeclLine, Entry->DeclColumn);
+        }
+    }
+
+    for (Data = Copied.begin(); Data != Copied.end(); ++Data)
+    {
+        if (Data->second.Typ != nullptr)
+            ParallelRelocate(pc, Clone, Copied, Data->second.NewData, Data->second.Typ);
+    }
+}
+
+/* pass a clone's output on to the output of the interpreter it was cloned from */
+static void ParallelForwardOutput(void *SinkContext, const char *Data, int Len)
+{
+    struct ParallelJob *Job = (struct ParallelJob *)SinkContext;
+    std::lock_guard<std::mutex> Guard(Job->OutputLock);
+
+    PlatformWrite(Job->pc->CStdOut, Data, Len);
+}
+
+/* create a clone for a worker. its output is passed on a line at a time so lines from
+ * different workers aren't mixed together. returns false if loading failed */
+static int ParallelCloneCreate(struct ParallelJob *Job, Picoc *Clone)
+{
+    PicocInitialise(Clone, Job->pc->HeapSize);
+    PicocSetOutputSink(Clone, ParallelForwardOutput, Job);
+    PicocSetOutputFlushPolicy(Clone, OutputFlushLine);
+    if (PicocPlatformSetExitPoint(Clone))
+        return false;
+
+    PicocClone(Job->pc, Clone);
+    return true;
+}
+
+/* take a chunk of work from a worker. returns -1 if it has none left */
+static int ParallelTakeChunk(struct ParallelWorker *Worker, int FromBack)
+{
+    std::lock_guard<std::mutex> Guard(Worker->Lock);
+
+    if (Worker->NextChunk >= Worker->EndChunk)
+        return -1;
+
+    return FromBack ? --Worker->EndChunk : Worker->NextChunk++;
+}
+
+/* run chunks on a worker's clone until there are none left to take or steal */
+static void ParallelWorkerRun(struct ParallelJob *Job, int WorkerNum)
+{
+    struct ParallelWorker *Self = &Job->Workers[WorkerNum];
+
+    if (PicocPlatformSetExitPoint(Self->Clone))
+    {
+        Job->Failed = true;
+        return;
+    }
+
+    while (!Job->Failed)
+    {
+        int Chunk = ParallelTakeChunk(Self, false);
+        int Count;
+        int FirstCall;
+        int NumCalls;
+
+        for (Count = 1; Chunk < 0 && Count < Job->NumWorkers; Count++)
+            Chunk = ParallelTakeChunk(&Job->Workers[(WorkerNum + Count) % Job->NumWorkers], true);
+
+        if (Chunk < 0)
+            break;
+
+        FirstCall = Chunk * Job->ChunkSize;
+        NumCalls = Job->NumCalls - FirstCall;
+        if (NumCalls > Job->ChunkSize)
+            NumCalls = Job->ChunkSize;
+
+        PicocCallFunctionBatch(Self->Clone, Job->FuncName, NumCalls, &Job->Args[FirstCall * Job->NumParams], (Job->Results != nullptr) ? &Job->Results[FirstCall] : nullptr);
+    }
+}
+
+/* call a function over NumCalls argument tuples, laid out as for PicocCallFunctionBatch(),
+ * using NumWorkers threads each with its own clone of pc. results are stored in call order.
+ * NumWorkers <= 0 uses one worker per hardware thread. returns false if any call failed */
+int PicocParallelMap(Picoc *pc, const char *FuncName, int NumCalls, union AnyValue *Args, union AnyValue *Results, int NumWorkers)
+{
+    struct Value *FuncValue = nullptr;
+    struct ParallelJob Job;
+    std::thread *Threads;
+    int NumChunks;
+    int Count;
+
+    if (!VariableDefined(pc, TableStrRegister(pc, FuncName)))
+        ProgramFailNoParser(pc, "%s() is not defined", FuncName);
+
+    VariableGet(pc, nullptr, TableStrRegister(pc, FuncName), &FuncValue);
+    if (FuncValue->Typ->Base != TypeFunction)
+        ProgramFailNoParser(pc, "%s is not a function - can't call it", FuncName);
+
+    if (NumCalls <= 0)
+        return true;
+
+    if (NumWorkers <= 0)
+        NumWorkers = std::thread::hardware_concurrency();
+
+    if (NumWorkers > NumCalls)
+        NumWorkers = NumCalls;
+
+    if (NumWorkers <= 0)
+        NumWorkers = 1;
+
+    /* divide the calls into chunks and give each worker a contiguous range of them */
+    NumChunks = NumWorkers * PARALLEL_CHUNKS_PER_WORKER;
+    if (NumChunks > NumCalls)
+        NumChunks = NumCalls;
+
+    Job.FuncName = FuncName;
+    Job.NumParams = FuncValue->Val->FuncDef.NumParams;
+    Job.NumCalls = NumCalls;
+    Job.ChunkSize = (NumCalls + NumChunks - 1) / NumChunks;
+    Job.Args = Args;
+    Job.Results = Results;
+    Job.NumWorkers = NumWorkers;
+    Job.Failed = false;
+    Job.pc = pc;
+    Job.Workers = new ParallelWorker[NumWorkers];
+    NumChunks = (NumCalls + Job.ChunkSize - 1) / Job.ChunkSize;
+
+    /* clones are made one at a time since initialising them touches some process-wide state */
+    for (Count = 0; Count < NumWorkers; Count++)
+    {
+        struct ParallelWorker *Worker = &Job.Workers[Count];
+
+        Worker->NextChunk = NumChunks * Count / NumWorkers;
+        Worker->EndChunk = NumChunks * (Count + 1) / NumWorkers;
+        Worker->Clone = (Picoc *)malloc(sizeof(Picoc));
+        if (Worker->Clone == nullptr || !ParallelCloneCreate(&Job, Worker->Clone))
+            Job.Failed = true;
+    }
+
+    /* the calling thread acts as the first worker */
+    Threads = new std::thread[NumWorkers];
+    if (!Job.Failed)
+    {
+        for (Count = 1; Count < NumWorkers; Count++)
+            Threads[Count] = std::thread(ParallelWorkerRun, &Job, Count);
+
+        ParallelWorkerRun(&Job, 0);
+
+        for (Count = 1; Count < NumWorkers; Count++)
+            Threads[Count].join();
+    }
+
+    for (Count = 0; Count < NumWorkers; Count++)
+    {
+        if (Job.Workers[Count].Clone != nullptr)
+        {
+            PicocCleanup(Job.Workers[Count].Clone);
+            free(Job.Workers[Count].Clone);
+        }
+    }
+
+    delete[] Threads;
+    delete[] Job.Workers;
+
+    return !Job.Failed;
+}
+
+/* throw away a lexing clone's output. errors are reported when the file is lexed again */
+static void ParallelDiscardOutput(void *, const char *, int)
+{
+}
+
+/* tokenise files on a clone until there are none left */
+static void ParallelLexWorkerRun(struct ParallelLexJob *Job, Picoc *Clone)
+{
+    int FileNum;
+
+    while ((FileNum = Job->NextFile++) < Job->NumFiles)
+    {
+        /* a file which fails to lex is left with no tokens */
+        if (PicocPlatformSetExitPoint(Clone))
+            continue;
+
+        Job->Tokens[FileNum] = LexAnalyse(Clone, Job->FileNames[FileNum], Job->Sources[FileNum], Job->SourceLens[FileNum], nullptr);
+    }
+}
+
+/* tokenise NumFiles sources at once, with a thread and a fresh interpreter for each hardware
+ * thread, then have pc adopt the tokens so they can be given to ParseTokens(). a source
+ * which fails to lex gets nullptr tokens so the caller can lex it again itself and have
+ * the error reported in the usual way and at the usual point */
+void ParallelLex(Picoc *pc, int NumFiles, char **FileNames, const char **Sources, int *SourceLens, void **Tokens)
+{
+    struct ParallelLexJob Job;
+    std::thread *Threads;
+    Picoc *Clones;
+    int NumWorkers = std::thread::hardware_concurrency();
+    int Count;
+
+    if (NumWorkers > NumFiles)
+        NumWorkers = NumFiles;
+
+    if (NumWorkers <= 0)
+        NumWorkers = 1;
+
+    Job.FileNames = FileNames;
+    Job.Sources = Sources;
+    Job.SourceLens = SourceLens;
+    Job.Tokens = Tokens;
+    Job.NumFiles = NumFiles;
+    Job.NextFile = 0;
+    for (Count = 0; Count < NumFiles; Count++)
+        Tokens[Count] = nullptr;
+
+    Clones = (Picoc *)malloc(sizeof(Picoc) * NumWorkers);
+    if (Clones == nullptr)
+        return;
+
+    /* clones are created one at a time since initialisation touches some process-wide state */
+    for (Count = 0; Count < NumWorkers; Count++)
+    {
+        PicocInitialise(&Clones[Count], pc->HeapSize);
+        PicocSetOutputSink(&Clones[Count], ParallelDiscardOutput, nullptr);
+    }
+
+    /* the calling thread acts as the first worker */
+    Threads = new std::thread[NumWorkers];
+    for (Count = 1; Count < NumWorkers; Count++)
+        Threads[Count] = std::thread(ParallelLexWorkerRun, &Job, &Clones[Count]);
+
+    ParallelLexWorkerRun(&Job, &Clones[0]);
+
+    for (Count = 1; Count < NumWorkers; Count++)
+        Threads[Count].join();
+
+    /* the tokens refer to the clones' strings so re-register them before the clones go */
+    for (Count = 0; Count < NumFiles; Count++)
+    {
+        if (Tokens[Count] != nullptr)
+            LexAdoptTokens(pc, Tokens[Count]);
+    }
+
+    for (Count = 0; Count < NumWorkers; Count++)
+        PicocCleanup(&Clones[Count]);
+
+    delete[] Threads;
+    free(Clones);
+}
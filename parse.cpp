@@ -12,7 +12,7 @@ void ParseCleanup(Picoc *pc)
 
         HeapFreeMem(pc, pc->CleanupTokenList->Tokens);
         if (pc->CleanupTokenList->SourceText != nullptr)
-            HeapFreeMem(pc, (void *)pc->CleanupTokenList->SourceText);
+            free((void *)pc->CleanupTokenList->SourceText);     /* the host malloc()ed it */
 
         HeapFreeMem(pc, pc->CleanupTokenList);
         pc->CleanupTokenList = Next;
@@ -385,6 +385,9 @@ void ParseMacroDefinition(struct ParseState *Parser)
 
         ParserCopy(&ParamParser, Parser);
         NumParams = ParseCountParams(&ParamParser);
+        if (NumParams > PARAMETER_MAX)
+            ProgramFail(Parser, "too many parameters (%d allowed)", PARAMETER_MAX);
+
         MacroValue = VariableAllocValueAndData(Parser->pc, Parser, sizeof(struct MacroDef) + sizeof(const char *) * NumParams, false, nullptr, true);
         MacroValue->Val->MacroDef.NumParams = NumParams;
         MacroValue->Val->MacroDef.ParamName = (char **)((char *)MacroValue->Val + sizeof(struct MacroDef));
@@ -526,8 +529,11 @@ enum RunMode ParseBlock(struct ParseState *Parser, int AbsorbOpenBrace, int Cond
         /* condition failed - skip this block instead */
         enum RunMode OldMode = Parser->Mode;
         Parser->Mode = RunModeSkip;
-        while (ParseStatement(Parser, true) == ParseResultOk)
-        {}
+        if (!LexSkipBlock(Parser))
+        {
+            while (ParseStatement(Parser, true) == ParseResultOk)
+            {}
+        }
         Parser->Mode = OldMode;
     }
     else
@@ -578,6 +584,13 @@ enum ParseResult ParseStatement(struct ParseState *Parser, int CheckTrailingSemi
     if (Parser->DebugMode && Parser->Mode == RunModeRun)
         DebugCheckStatement(Parser);
 
+    /* if the sampling profiler's timer has gone off, take a sample here */
+    if (Parser->pc->ProfileSamplePending && Parser->Mode == RunModeRun)
+        ProfileSample(Parser);
+
+    if (Parser->pc->LineCountFileName != nullptr && Parser->Mode == RunModeRun)
+        ProfileCountLine(Parser);
+
     /* take note of where we are and then grab a token to see what statement we have */
     ParserCopy(&PreState, Parser);
     Token = LexGetToken(Parser, &LexerValue, true);
@@ -934,14 +947,27 @@ enum ParseResult ParseStatement(struct ParseState *Parser, int CheckTrailingSemi
 
 /* quick scan a source file for definitions */
 void PicocParse(Picoc *pc, const char *FileName, const char *Source, int SourceLen, int RunIt, int CleanupNow, int CleanupSource, int EnableDebugger)
+{
+    void *Tokens;
+
+    if (pc->ProfileCounting)
+        ProfileCountersBegin(pc, &pc->ProfileLoadCounts[0]);
+
+    Tokens = LexAnalyse(pc, TableStrRegister(pc, FileName), Source, SourceLen, nullptr);
+    ParseTokens(pc, FileName, Source, Tokens, RunIt, CleanupNow, CleanupSource, EnableDebugger);
+
+    if (pc->ProfileCounting)
+        ProfileCountersEnd(pc);
+}
+
+/* parse source which has already been tokenised. the tokens become owned by the parser */
+void ParseTokens(Picoc *pc, const char *FileName, const char *Source, void *Tokens, int RunIt, int CleanupNow, int CleanupSource, int EnableDebugger)
 {
     struct ParseState Parser;
     enum ParseResult Ok;
     struct CleanupTokenNode *NewCleanupNode;
     char *RegFileName = TableStrRegister(pc, FileName);
 
-    void *Tokens = LexAnalyse(pc, RegFileName, Source, SourceLen, nullptr);
-
     /* allocate a cleanup node so we can clean up the tokens later */
     if (!CleanupNow)
     {
@@ -961,6 +987,8 @@ void PicocParse(Picoc *pc, const char *FileName, const char *Source, int SourceL
 
     /* do the parsing */
     LexInitParser(&Parser, pc, Source, Tokens, RegFileName, RunIt, EnableDebugger);
+    if (pc->ProfileCounting)
+        ProfileCountersBegin(pc, &pc->ProfileLoadCounts[0]);
 
     do {
         Ok = ParseStatement(&Parser, true);
@@ -969,6 +997,9 @@ void PicocParse(Picoc *pc, const char *FileName, const char *Source, int SourceL
     if (Ok == ParseResultError)
         ProgramFail(&Parser, "parse error");
 
+    if (pc->ProfileCounting)
+        ProfileCountersEnd(pc);
+
     /* clean up */
     if (CleanupNow)
         HeapFreeMem(pc, Tokens);
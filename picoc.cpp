@@ -10,10 +10,53 @@
 
 constexpr int PICOC_STACK_SIZE = 128*1024;			/* space for the the stack */
 
+/* print how long each phase of starting up took and what it allocated, then what memory is in use */
+static void PrintStats(Picoc *pc)
+{
+	const struct StartupPhase *Phases;
+	int NumPhases = PicocStartupPhases(pc, &Phases);
+	struct MemoryStats Memory;
+	long long TotalNs = 0;
+	unsigned long TotalAllocs = 0;
+	unsigned long TotalBytes = 0;
+	int Count;
+
+	PicocFlushOutput(pc);
+	fflush(stdout);
+	fprintf(stderr, "\n%-24s %12s %10s %12s\n", "startup phase", "time us", "allocs", "bytes");
+	for (Count = 0; Count < NumPhases; Count++)
+	{
+		fprintf(stderr, "%-24s %12.1f %10lu %12lu\n", Phases[Count].Name, Phases[Count].Ns / 1e3, Phases[Count].Allocs, Phases[Count].AllocBytes);
+		TotalNs += Phases[Count].Ns;
+		TotalAllocs += Phases[Count].Allocs;
+		TotalBytes += Phases[Count].AllocBytes;
+	}
+
+	fprintf(stderr, "%-24s %12.1f %10lu %12lu\n", "total", TotalNs / 1e3, TotalAllocs, TotalBytes);
+
+	PicocMemoryStats(pc, &Memory);
+	fprintf(stderr, "\n%-24s %10s %12s\n", "memory in use", "count", "bytes");
+	fprintf(stderr, "%-24s %10s %12d\n", "stack", "", Memory.StackBytes);
+	fprintf(stderr, "%-24s %10s %12d of %d\n", "stack peak", "", Memory.StackPeakBytes, Memory.StackSize);
+	fprintf(stderr, "%-24s %10ld %12ld\n", "heap", Memory.HeapAllocs, Memory.HeapBytes);
+	fprintf(stderr, "%-24s %10d %12d\n", "strings", Memory.Strings, Memory.StringBytes);
+	fprintf(stderr, "%-24s %10d %12d\n", "source tokens", Memory.TokenBuffers, Memory.TokenBytes);
+	fprintf(stderr, "%-24s %10d %12d\n", "function bodies", Memory.Bodies, Memory.BodyBytes);
+	fprintf(stderr, "%-24s %10d\n", "types", Memory.TypeNodes);
+}
+
 int main(int argc, char **argv)
 {
 	int ParamCount = 1;
 	bool DontRunMain = false;
+	bool ParallelLex = false;
+	bool Stats = false;
+	bool PerfCounters = false;
+	bool Profile = false;
+	const char *ProfileFileName = nullptr;
+	const char *SampleFileName = nullptr;
+	const char *LineCountFileName = nullptr;
+	const char *TraceFileName = nullptr;
 	int StackSize = PICOC_STACK_SIZE;
 	Picoc pc;
 
@@ -21,19 +64,94 @@ int main(int argc, char **argv)
 	{
 		printf("Format: picoc <csource1.c>... [- <arg1>...]    : run a program (calls main() to start it)\n"
 			   "        picoc -s <csource1.c>... [- <arg1>...] : script mode - runs the program without calling main()\n"
-			   "        picoc -i                               : interactive mode\n");
+			   "        picoc [-s] -j <csource1.c>... [- <arg1>...] : tokenise the source files in parallel before running\n"
+			   "        picoc [-s] [-j] -p <csource1.c>... [- <arg1>...] : print a profile of the function calls on exit\n"
+			   "        picoc [-s] [-j] -P <profile.tsv> <csource1.c>... [- <arg1>...] : also write the profile to a file\n"
+			   "        picoc [-s] [-j] [-p] -F <stacks.folded> <csource1.c>... [- <arg1>...] : sample the call stack and write it for a flame graph\n"
+			   "        picoc [-s] [-j] [-p] [-F <stacks.folded>] -L <lines.txt> <csource1.c>... [- <arg1>...] : count the runs of each line and write the annotated source\n"
+			   "        picoc [-s] [-j] [-p] [-F <stacks.folded>] [-L <lines.txt>] -T <trace.json> <csource1.c>... [- <arg1>...] : write a trace for a trace viewer\n"
+			   "        picoc -i                               : interactive mode\n"
+			   "        picoc [--stats] [--perf-counters] <any of the above> : --stats also prints the time and memory each phase of starting up took and the memory in use at exit,\n"
+			   "                                                       --perf-counters also prints hardware event counts for loading, running and each function\n"
+			   "Flags must be given in this order: --stats, --perf-counters, -s, -j, -p/-P, -F, -L, -T\n");
 		exit(1);
 	}
 
 	PicocInitialise(&pc, StackSize);
 
-	if (strcmp(argv[ParamCount], "-s") == 0 || strcmp(argv[ParamCount], "-m") == 0)
+	if (strcmp(argv[ParamCount], "--stats") == 0)
+	{
+		Stats = true;
+		ParamCount++;
+	}
+
+	if (argc > ParamCount && strcmp(argv[ParamCount], "--perf-counters") == 0)
+	{
+		PerfCounters = true;
+		ParamCount++;
+	}
+
+	if (argc > ParamCount && (strcmp(argv[ParamCount], "-s") == 0 || strcmp(argv[ParamCount], "-m") == 0))
 	{
 		DontRunMain = true;
-		PicocIncludeAllSystemHeaders(&pc);
 		ParamCount++;
 	}
 
+	if (argc > ParamCount && strcmp(argv[ParamCount], "-j") == 0)
+	{
+		ParallelLex = true;
+		ParamCount++;
+	}
+
+	if (argc > ParamCount && strcmp(argv[ParamCount], "-p") == 0)
+	{
+		Profile = true;
+		ParamCount++;
+	}
+	else if (argc > ParamCount + 1 && strcmp(argv[ParamCount], "-P") == 0)
+	{
+		Profile = true;
+		ProfileFileName = argv[ParamCount + 1];
+		ParamCount += 2;
+	}
+
+	if (argc > ParamCount + 1 && strcmp(argv[ParamCount], "-F") == 0)
+	{
+		SampleFileName = argv[ParamCount + 1];
+		ParamCount += 2;
+	}
+
+	if (argc > ParamCount + 1 && strcmp(argv[ParamCount], "-L") == 0)
+	{
+		LineCountFileName = argv[ParamCount + 1];
+		ParamCount += 2;
+	}
+
+	if (argc > ParamCount + 1 && strcmp(argv[ParamCount], "-T") == 0)
+	{
+		TraceFileName = argv[ParamCount + 1];
+		ParamCount += 2;
+	}
+
+	if (Profile)
+		PicocProfileEnable(&pc, ProfileFileName);
+
+	if (SampleFileName != nullptr)
+		PicocProfileSample(&pc, SampleFileName);
+
+	if (LineCountFileName != nullptr)
+		PicocProfileLines(&pc, LineCountFileName);
+
+	if (TraceFileName != nullptr)
+		PicocProfileTrace(&pc, TraceFileName);
+
+	if (PerfCounters)
+		PicocProfileCounters(&pc);
+
+	/* script mode includes the system headers after the profiler's set up so they can be traced */
+	if (DontRunMain)
+		PicocIncludeAllSystemHeaders(&pc);
+
 	if (argc > ParamCount && strcmp(argv[ParamCount], "-i") == 0)
 	{
 		PicocIncludeAllSystemHeaders(&pc);
@@ -43,15 +161,35 @@ int main(int argc, char **argv)
 	{
 		if (PicocPlatformSetExitPoint(&pc))
 		{
+			PicocProfileReport(&pc);
+			if (Stats)
+				PrintStats(&pc);
+
 			PicocCleanup(&pc);
 			return pc.PicocExitValue;
 		}
 
-		for (; ParamCount < argc && strcmp(argv[ParamCount], "-") != 0; ParamCount++)
-			PicocPlatformScanFile(&pc, argv[ParamCount]);
+		if (ParallelLex)
+		{
+			int FirstFile = ParamCount;
+
+			for (; ParamCount < argc && strcmp(argv[ParamCount], "-") != 0; ParamCount++)
+			{}
+
+			PicocPlatformScanFiles(&pc, ParamCount - FirstFile, &argv[FirstFile]);
+		}
+		else
+		{
+			for (; ParamCount < argc && strcmp(argv[ParamCount], "-") != 0; ParamCount++)
+				PicocPlatformScanFile(&pc, argv[ParamCount]);
+		}
 
 		if (!DontRunMain)
 			PicocCallMain(&pc, argc - ParamCount, &argv[ParamCount]);
+
+		PicocProfileReport(&pc);
+		if (Stats)
+			PrintStats(&pc);
 	}
 
 	PicocCleanup(&pc);
@@ -24,9 +24,30 @@ void PicocParseInteractive(Picoc *);
 
 /* platform.c */
 void PicocCallMain(Picoc *, int, char **);
+void PicocCallFunctionBatch(Picoc *, const char *, int, union AnyValue *, union AnyValue *);
 void PicocInitialise(Picoc *, int);
 void PicocCleanup(Picoc *);
 void PicocPlatformScanFile(Picoc *, const char *);
+void PicocPlatformScanFiles(Picoc *, int, char **);
+void PicocSetOutputSink(Picoc *, OutputSink *, void *);
+void PicocSetOutputFlushPolicy(Picoc *, enum OutputFlushPolicy);
+void PicocFlushOutput(Picoc *);
+
+/* parallel.c */
+void PicocClone(Picoc *, Picoc *);
+int PicocParallelMap(Picoc *, const char *, int, union AnyValue *, union AnyValue *, int);
+
+/* profile.c */
+void PicocProfileEnable(Picoc *, const char *);
+void PicocProfileSample(Picoc *, const char *);
+void PicocProfileLines(Picoc *, const char *);
+void PicocProfileTrace(Picoc *, const char *);
+void PicocProfileCounters(Picoc *);
+int PicocStartupPhases(Picoc *, const struct StartupPhase **);
+void PicocProfileReport(Picoc *);
+
+/* heap.c */
+void PicocMemoryStats(Picoc *, struct MemoryStats *);
 
 /* include.c */
 void PicocIncludeAllSystemHeaders(Picoc *);
@@ -9,29 +9,45 @@
 void PicocInitialise(Picoc *pc, int StackSize)
 {
 	memset(pc, '\0', sizeof(*pc));
+	ProfilePhaseStart(pc);
 	PlatformInit(pc);
+	ProfilePhaseEnd(pc, "PlatformInit");
 	BasicIOInit(pc);
+	ProfilePhaseEnd(pc, "BasicIOInit");
 	HeapInit(pc, StackSize);
+	ProfilePhaseEnd(pc, "HeapInit");
 	TableInit(pc);
+	ProfilePhaseEnd(pc, "TableInit");
 	VariableInit(pc);
+	ProfilePhaseEnd(pc, "VariableInit");
 	LexInit(pc);
+	ProfilePhaseEnd(pc, "LexInit");
 	TypeInit(pc);
+	ProfilePhaseEnd(pc, "TypeInit");
 #ifndef NO_HASH_INCLUDE
 	IncludeInit(pc);
+	ProfilePhaseEnd(pc, "IncludeInit");
 #endif
 	LibraryInit(pc);
+	ProfilePhaseEnd(pc, "LibraryInit");
 #ifdef BUILTIN_MINI_STDLIB
 	LibraryAdd(pc, &GlobalTable, "c library", &CLibrary[0]);
 	CLibraryInit(pc);
+	ProfilePhaseEnd(pc, "CLibraryInit");
 #endif
 	PlatformLibraryInit(pc);
+	ProfilePhaseEnd(pc, "PlatformLibraryInit");
 	DebugInit(pc);
+	ProfileInit(pc);
+	ProfilePhaseEnd(pc, "DebugInit");
 }
 
 /* free memory */
 void PicocCleanup(Picoc *pc)
 {
+	BasicIOCleanup(pc);
 	DebugCleanup(pc);
+	ProfileCleanup(pc);
 #ifndef NO_HASH_INCLUDE
 	IncludeCleanup(pc);
 #endif
@@ -69,6 +85,9 @@ void PicocCallMain(Picoc *pc, int argc, char **argv)
 		VariableDefinePlatformVar(pc, nullptr, "__argv", pc->CharPtrPtrType, (union AnyValue *)&argv, false);
 	}
 
+	if (pc->ProfileCounting)
+		ProfileCountersBegin(pc, &pc->ProfileRunCounts[0]);
+
 	if (FuncValue->Val->FuncDef.ReturnType == &pc->VoidType)
 	{
 		if (FuncValue->Val->FuncDef.NumParams == 0)
@@ -85,6 +104,135 @@ void PicocCallMain(Picoc *pc, int argc, char **argv)
 		else
 			PicocParse(pc, "startup", CALL_MAIN_WITH_ARGS_RETURN_INT, strlen(CALL_MAIN_WITH_ARGS_RETURN_INT), true, true, false, true);
 	}
+
+	if (pc->ProfileCounting)
+		ProfileCountersEnd(pc);
+}
+
+/* call a function once for each of NumCalls argument tuples. Args holds NumCalls * NumParams
+ * values laid out tuple by tuple and each return value is stored in Results[Call], so a struct
+ * or union return value has to fit in a union AnyValue. The stack frame and parameter variables
+ * are set up once for the whole batch, so each call only has to copy its arguments in and run
+ * the body. Errors exit through PicocPlatformSetExitPoint() */
+void PicocCallFunctionBatch(Picoc *pc, const char *FuncName, int NumCalls, union AnyValue *Args, union AnyValue *Results)
+{
+	struct Value *FuncValue = nullptr;
+	struct FuncDef *Func;
+	struct Value *ReturnValue;
+	struct Value **ParamArray;
+	struct TableEntry *FrameHashTable[LOCAL_TABLE_SIZE];
+	struct ParseState Parser;
+	struct ParseState FuncParser;
+	char *RegFuncName = TableStrRegister(pc, FuncName);
+	int ReturnSize;
+	int Call;
+	int Count;
+
+	if (!VariableDefined(pc, RegFuncName))
+		ProgramFailNoParser(pc, "%s() is not defined", FuncName);
+
+	VariableGet(pc, nullptr, RegFuncName, &FuncValue);
+	if (FuncValue->Typ->Base != TypeFunction)
+		ProgramFailNoParser(pc, "%s is not a function - can't call it", FuncName);
+
+	Func = &FuncValue->Val->FuncDef;
+	if (Func->Intrinsic == nullptr && Func->Body.Pos == nullptr)
+		ProgramFailNoParser(pc, "'%s' is undefined", FuncName);
+
+	for (Count = 0; Count < Func->NumParams; Count++)
+	{
+		enum BaseType Base = Func->ParamType[Count]->Base;
+		if (Base == TypeStruct || Base == TypeUnion || Base == TypeArray)
+			ProgramFailNoParser(pc, "can't pass %t to %s() in a batch call", Func->ParamType[Count], FuncName);
+	}
+
+	if ((Func->ReturnType->Base == TypeStruct || Func->ReturnType->Base == TypeUnion) && Func->ReturnType->Sizeof > (int)sizeof(union AnyValue))
+		ProgramFailNoParser(pc, "can't return %t from %s() in a batch call", Func->ReturnType, FuncName);
+
+	LexInitParser(&Parser, pc, nullptr, nullptr, RegFuncName, true, false);
+	Parser.ScopeID = -1;
+	HeapPushStackFrame(pc);
+	ReturnValue = VariableAllocValueFromType(pc, &Parser, Func->ReturnType, false, nullptr, false);
+	ReturnSize = (Func->ReturnType == &pc->VoidType) ? 0 : TypeSizeValue(ReturnValue, false);
+
+	if (Func->Intrinsic == nullptr)
+	{
+		/* user-defined function - the frame and its parameters are shared by every call */
+		ParamArray = (Value**)HeapAllocStack(pc, sizeof(struct Value *) * Func->NumParams);
+		if (ParamArray == nullptr)
+			ProgramFailNoParser(pc, "out of memory");
+
+		VariableStackFrameAdd(&Parser, RegFuncName, 0);
+		pc->TopStackFrame->NumParams = Func->NumParams;
+		pc->TopStackFrame->ReturnValue = ReturnValue;
+		for (Count = 0; Count < Func->NumParams; Count++)
+			ParamArray[Count] = VariableDefine(pc, &Parser, Func->ParamName[Count], nullptr, Func->ParamType[Count], true);
+
+		/* locals defined by the body are dropped after each call by restoring this */
+		memcpy((void *)&FrameHashTable[0], (void *)&pc->TopStackFrame->LocalHashTable[0], sizeof(FrameHashTable));
+		ParserCopy(&FuncParser, &Func->Body);
+
+		for (Call = 0; Call < NumCalls; Call++)
+		{
+			HeapPushStackFrame(pc);
+			for (Count = 0; Count < Func->NumParams; Count++)
+				memcpy((void *)ParamArray[Count]->Val, (void *)&Args[Call * Func->NumParams + Count], TypeSizeValue(ParamArray[Count], false));
+
+			ParserCopyPos(&FuncParser, &Func->Body);
+			FuncParser.Mode = RunModeRun;
+			FuncParser.ScopeID = Func->Body.ScopeID;
+			if (pc->ProfileCalls)
+				ProfileEnter(&Parser, RegFuncName, Func->Intrinsic != nullptr);
+
+			if (ParseStatement(&FuncParser, true) != ParseResultOk)
+				ProgramFail(&FuncParser, "function body expected");
+
+			if (pc->ProfileCalls)
+				ProfileLeave(pc);
+
+			if (FuncParser.Mode == RunModeRun && ReturnSize != 0)
+				ProgramFail(&FuncParser, "no value returned from a function returning %t", Func->ReturnType);
+
+			else if (FuncParser.Mode == RunModeGoto)
+				ProgramFail(&FuncParser, "couldn't find goto label '%s'", FuncParser.SearchGotoLabel);
+
+			if (ReturnSize != 0 && Results != nullptr)
+				memcpy((void *)&Results[Call], (void *)ReturnValue->Val, ReturnSize);
+
+			memcpy((void *)&pc->TopStackFrame->LocalHashTable[0], (void *)&FrameHashTable[0], sizeof(FrameHashTable));
+			HeapPopStackFrame(pc);
+		}
+
+		VariableStackFramePop(&Parser);
+	}
+	else
+	{
+		/* library function - just reuse the parameter values */
+		ParamArray = (Value**)HeapAllocStack(pc, sizeof(struct Value *) * Func->NumParams);
+		if (ParamArray == nullptr)
+			ProgramFailNoParser(pc, "out of memory");
+
+		for (Count = 0; Count < Func->NumParams; Count++)
+			ParamArray[Count] = VariableAllocValueFromType(pc, &Parser, Func->ParamType[Count], false, nullptr, false);
+
+		for (Call = 0; Call < NumCalls; Call++)
+		{
+			for (Count = 0; Count < Func->NumParams; Count++)
+				memcpy((void *)ParamArray[Count]->Val, (void *)&Args[Call * Func->NumParams + Count], TypeSizeValue(ParamArray[Count], false));
+
+			if (pc->ProfileCalls)
+				ProfileEnter(&Parser, RegFuncName, Func->Intrinsic != nullptr);
+
+			((void (*)(struct ParseState *, struct Value *, struct Value **, int))(Func->Intrinsic))(&Parser, ReturnValue, ParamArray, Func->NumParams);
+			if (pc->ProfileCalls)
+				ProfileLeave(pc);
+
+			if (ReturnSize != 0 && Results != nullptr)
+				memcpy((void *)&Results[Call], (void *)ReturnValue->Val, ReturnSize);
+		}
+	}
+
+	HeapPopStackFrame(pc);
 }
 
 void PrintSourceTextErrorLine(IOFILE *Stream, const char *FileName, const char *SourceText, int Line, int CharacterPos)
@@ -175,6 +323,7 @@ void LexFail(Picoc *pc, struct LexState *Lexer, const char *Message, ...)
 	PlatformVPrintf(pc->CStdOut, Message, Args);
 	va_end(Args);
 	PlatformPrintf(pc->CStdOut, "\n");
+	LexFreeTokenSpace(pc);
 	PlatformExit(pc, 1);
 }
 
@@ -227,6 +376,57 @@ void PlatformVPrintf(IOFILE *Stream, const char *Format, va_list Args)
 	}
 }
 
+/* add some output to a buffer, passing it on to the sink as the flush policy says */
+void PlatformWrite(IOFILE *Stream, const char *Data, int Len)
+{
+	if (Stream->Used + Len > OUTPUT_BUFFER_SIZE)
+	{
+		PlatformFlush(Stream);
+		if (Len > OUTPUT_BUFFER_SIZE)
+		{
+			/* too big to buffer - send it straight through */
+			Stream->Sink(Stream->SinkContext, Data, Len);
+			return;
+		}
+	}
+
+	memcpy((void *)&Stream->Buf[Stream->Used], (void *)Data, Len);
+	Stream->Used += Len;
+
+	if (Stream->Policy == OutputFlushUnbuffered || (Stream->Policy == OutputFlushLine && memchr(Data, '\n', Len) != nullptr))
+		PlatformFlush(Stream);
+}
+
+/* pass any buffered output on to the sink */
+void PlatformFlush(IOFILE *Stream)
+{
+	if (Stream->Used > 0)
+	{
+		Stream->Sink(Stream->SinkContext, &Stream->Buf[0], Stream->Used);
+		Stream->Used = 0;
+	}
+}
+
+/* send the interpreter's output somewhere other than the console */
+void PicocSetOutputSink(Picoc *pc, OutputSink *Sink, void *SinkContext)
+{
+	PlatformFlush(pc->CStdOut);
+	pc->CStdOut->Sink = Sink;
+	pc->CStdOut->SinkContext = SinkContext;
+}
+
+void PicocSetOutputFlushPolicy(Picoc *pc, enum OutputFlushPolicy Policy)
+{
+	pc->CStdOut->Policy = Policy;
+	if (Policy != OutputFlushFull)
+		PlatformFlush(pc->CStdOut);
+}
+
+void PicocFlushOutput(Picoc *pc)
+{
+	PlatformFlush(pc->CStdOut);
+}
+
 /* make a new temporary name. takes a static buffer of char [7] as a parameter. should be initialised to "XX0000"
  * where XX can be any characters */
 char *PlatformMakeTempName(Picoc *pc, char *TempNameBuffer)
@@ -18,11 +18,20 @@
 constexpr int GLOBAL_TABLE_SIZE = 97;				/* global variable table */
 constexpr int STRING_TABLE_SIZE = 97;				/* shared string table size */
 constexpr int STRING_LITERAL_TABLE_SIZE = 97;		/* string literal table size */
-constexpr int RESERVED_WORD_TABLE_SIZE = 97;		/* reserved word table size */
+constexpr int STATIC_SITE_TABLE_SIZE = 97;			/* static variable declaration site table size */
+constexpr int FOLDED_CONSTANT_TABLE_SIZE = 97;		/* folded constant expression table size */
+constexpr int MACRO_EXPANSION_TABLE_SIZE = 97;		/* macro call expansion table size */
+constexpr int OPERAND_EXTENT_TABLE_SIZE = 97;		/* skipped operand extent table size */
 constexpr int PARAMETER_MAX = 16;					/* maximum number of parameters to a function */
 constexpr int LINEBUFFER_MAX = 256;					/* maximum number of characters on a line */
 constexpr int LOCAL_TABLE_SIZE = 11;				/* size of local variable table (can expand) */
 constexpr int STRUCT_TABLE_SIZE = 11;				/* size of struct/union member table (can expand) */
+constexpr int OUTPUT_BUFFER_SIZE = 4096;			/* size of the interpreter's output buffer */
+constexpr int PRINTF_FORMAT_TABLE_SIZE = 97;		/* parsed printf format cache size */
+constexpr int PROFILE_TABLE_SIZE = 97;				/* function profile table size */
+constexpr int PROFILE_SAMPLE_TABLE_SIZE = 97;		/* sampled call stack table size */
+constexpr int PROFILE_SAMPLE_INTERVAL_US = 1000;	/* CPU time between profile samples */
+constexpr int STARTUP_PHASE_MAX = 16;				/* startup phases which can be timed */
 
 #define INTERACTIVE_PROMPT_START "starting picoc " PICOC_VERSION "\n"
 constexpr const char* INTERACTIVE_PROMPT_STATEMENT = "picoc> ";
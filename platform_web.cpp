@@ -1,6 +1,8 @@
 #include "picoc.h"
 #include "interpreter.h"
 #include <cstdio>
+#include <fcntl.h>
+#include <sys/mman.h>
 
 #ifdef USE_READLINE
 #include <readline/readline.h>
@@ -11,23 +13,178 @@
 jmp_buf PicocExitBuf;
 
 #include <signal.h>
+#include <sys/time.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
 
 Picoc *break_pc = nullptr;
 
-static void BreakHandler(int Signal)
+static void BreakHandler(int)
+{
+    if (break_pc != nullptr)
+        break_pc->DebugManualBreak = true;
+}
+
+Picoc *sample_pc = nullptr;
+
+static void SampleHandler(int)
+{
+    if (sample_pc != nullptr)
+        sample_pc->ProfileSamplePending = true;
+}
+
+/* ask for a profile sample every IntervalUs of CPU time, or stop if IntervalUs is 0.
+ * only one interpreter at a time can be sampled */
+void PlatformSampleTimer(Picoc *pc, int IntervalUs)
+{
+	struct itimerval Timer;
+
+	if (IntervalUs > 0)
+	{
+		if (sample_pc != nullptr)
+			return;
+
+		sample_pc = pc;
+		signal(SIGPROF, SampleHandler);
+	}
+	else if (sample_pc != pc)
+		return;
+
+	Timer.it_interval.tv_sec = IntervalUs / 1000000;
+	Timer.it_interval.tv_usec = IntervalUs % 1000000;
+	Timer.it_value = Timer.it_interval;
+	setitimer(ITIMER_PROF, &Timer, nullptr);
+
+	if (IntervalUs == 0)
+	{
+		signal(SIGPROF, SIG_IGN);
+		sample_pc = nullptr;
+	}
+}
+
+#ifdef __linux__
+/* the perf events for each ProfileCounter */
+static const struct { unsigned Type; unsigned long long Config; } CounterEvents[NumProfileCounters] =
+{
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+	{ PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+	{ PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) }
+};
+#endif
+
+/* start counting hardware events in user space on this thread, as one group so they
+ * can all be read at once. counters the machine doesn't have are left out. returns
+ * the number of counters which could be opened */
+int PlatformCountersOpen(Picoc *pc)
 {
-    break_pc->DebugManualBreak = true;
+	int Opened = 0;
+	int Count;
+
+	pc->ProfileCounterGroup = -1;
+	for (Count = 0; Count < NumProfileCounters; Count++)
+	{
+		pc->ProfileCounterFd[Count] = -1;
+#ifdef __linux__
+		struct perf_event_attr Attr;
+
+		memset((void *)&Attr, '\0', sizeof(Attr));
+		Attr.type = CounterEvents[Count].Type;
+		Attr.size = sizeof(Attr);
+		Attr.config = CounterEvents[Count].Config;
+		Attr.read_format = PERF_FORMAT_GROUP;
+		Attr.exclude_kernel = 1;
+		Attr.exclude_hv = 1;
+		pc->ProfileCounterFd[Count] = syscall(SYS_perf_event_open, &Attr, 0, -1, pc->ProfileCounterGroup, 0);
+		if (pc->ProfileCounterFd[Count] >= 0)
+		{
+			if (pc->ProfileCounterGroup < 0)
+				pc->ProfileCounterGroup = pc->ProfileCounterFd[Count];
+
+			Opened++;
+		}
+#endif
+	}
+
+	return Opened;
+}
+
+/* read the hardware event counts. counters which aren't available read as 0 */
+void PlatformCountersRead(Picoc *pc, long long *Counts)
+{
+	unsigned long long Values[NumProfileCounters + 1];
+	int Value = 1;
+	int Count;
+
+	memset((void *)Values, '\0', sizeof(Values));
+	if (pc->ProfileCounterGroup >= 0 && read(pc->ProfileCounterGroup, Values, sizeof(Values)) < 0)
+		Values[0] = 0;
+
+	/* the group's counts come after their number, in the order the counters were opened */
+	for (Count = 0; Count < NumProfileCounters; Count++)
+	{
+		if (pc->ProfileCounterFd[Count] >= 0 && Value <= (int)Values[0])
+			Counts[Count] = Values[Value++];
+		else
+			Counts[Count] = 0;
+	}
+}
+
+void PlatformCountersClose(Picoc *pc)
+{
+	int Count;
+
+	for (Count = 0; Count < NumProfileCounters; Count++)
+	{
+		if (pc->ProfileCounterFd[Count] >= 0)
+			close(pc->ProfileCounterFd[Count]);
+
+		pc->ProfileCounterFd[Count] = -1;
+	}
+
+	pc->ProfileCounterGroup = -1;
 }
 
 void PlatformInit(Picoc *pc)
 {
-	/* capture the break signal and pass it to the debugger */
-	break_pc = pc;
-	signal(SIGINT, BreakHandler);
+	/* capture the break signal and pass it to the debugger of the first interpreter */
+	if (break_pc == nullptr)
+	{
+		break_pc = pc;
+		signal(SIGINT, BreakHandler);
+	}
 }
 
 void PlatformCleanup(Picoc *pc)
 {
+	if (break_pc == pc)
+		break_pc = nullptr;
+
+	/* scanning files may have failed part way through */
+	if (pc->ScanFilesSpace != nullptr)
+	{
+		HeapFreeMem(pc, pc->ScanFilesSpace);
+		pc->ScanFilesSpace = nullptr;
+	}
+
+	while (pc->SourceFileList != nullptr)
+	{
+		struct SourceFileNode *Next = pc->SourceFileList->Next;
+
+		if (pc->SourceFileList->Tokens != nullptr)
+			HeapFreeMem(pc, pc->SourceFileList->Tokens);
+
+		if (pc->SourceFileList->Mapped)
+			munmap((void *)pc->SourceFileList->Text, pc->SourceFileList->Len);
+		else
+			free((void *)pc->SourceFileList->Text);
+
+		free(pc->SourceFileList);
+		pc->SourceFileList = Next;
+	}
 }
 
 /* get a line of interactive input */
@@ -68,58 +225,156 @@ int PlatformGetCharacter()
 }
 
 /* write a character to the console */
-void PlatformPutc(unsigned char OutCh, union OutputStreamInfo *Stream)
+void PlatformPutc(unsigned char OutCh, union OutputStreamInfo *)
 {
 	putchar(OutCh);
 }
 
-/* read a file into memory */
-char *PlatformReadFile(Picoc *pc, const char *FileName)
+/* write buffered output to the console */
+void PlatformStdoutSink(void *, const char *Data, int Len)
+{
+	fwrite(Data, 1, Len, stdout);
+}
+
+/* read a file into memory. it's mapped read-only where possible and otherwise read into a
+ * heap buffer. files whose size is a whole number of pages are read since the lexer may look
+ * one character past the end. the text stays valid until PlatformCleanup() */
+const char *PlatformReadFile(Picoc *pc, const char *FileName, int *Len)
 {
 	struct stat FileInfo;
-	char *ReadText;
-	FILE *InFile;
+	struct SourceFileNode *SourceFile;
+	char *ReadText = nullptr;
+	int Mapped = false;
+	int InFile;
 	int BytesRead;
-	char *p;
 
-	if (stat(FileName, &FileInfo))
+	InFile = open(FileName, O_RDONLY);
+	if (InFile < 0 || fstat(InFile, &FileInfo) || FileInfo.st_size == 0)
 		ProgramFailNoParser(pc, "can't read file %s\n", FileName);
 
-	ReadText = (char*)malloc(FileInfo.st_size + 1);
+	if (S_ISREG(FileInfo.st_mode) && FileInfo.st_size % sysconf(_SC_PAGESIZE) != 0)
+	{
+		ReadText = (char *)mmap(nullptr, FileInfo.st_size, PROT_READ, MAP_PRIVATE, InFile, 0);
+		if (ReadText == MAP_FAILED)
+			ReadText = nullptr;
+		else
+			Mapped = true;
+	}
+
 	if (ReadText == nullptr)
-		ProgramFailNoParser(pc, "out of memory\n");
+	{
+		ReadText = (char *)malloc(FileInfo.st_size + 1);
+		if (ReadText == nullptr)
+			ProgramFailNoParser(pc, "out of memory\n");
 
-	InFile = fopen(FileName, "r");
-	if (InFile == nullptr)
-		ProgramFailNoParser(pc, "can't read file %s\n", FileName);
+		BytesRead = read(InFile, ReadText, FileInfo.st_size);
+		if (BytesRead <= 0)
+			ProgramFailNoParser(pc, "can't read file %s\n", FileName);
 
-	BytesRead = fread(ReadText, 1, FileInfo.st_size, InFile);
-	if (BytesRead == 0)
-		ProgramFailNoParser(pc, "can't read file %s\n", FileName);
+		ReadText[BytesRead] = '\0';
+		FileInfo.st_size = BytesRead;
+	}
 
-	ReadText[BytesRead] = '\0';
-	fclose(InFile);
+	close(InFile);
 
-	if ((ReadText[0] == '#') && (ReadText[1] == '!'))
-		for (p = ReadText; (*p != '\r') && (*p != '\n'); ++p)
-			*p = ' ';
+	SourceFile = (struct SourceFileNode *)malloc(sizeof(struct SourceFileNode));
+	if (SourceFile == nullptr)
+		ProgramFailNoParser(pc, "out of memory\n");
+
+	SourceFile->Text = ReadText;
+	SourceFile->Len = FileInfo.st_size;
+	SourceFile->Mapped = Mapped;
+	SourceFile->Tokens = nullptr;
+	SourceFile->Next = pc->SourceFileList;
+	pc->SourceFileList = SourceFile;
 
+	*Len = FileInfo.st_size;
 	return ReadText;
 }
 
-/* read and scan a file for definitions */
+/* read and scan a file for definitions. once it's been tokenised the source is only needed
+ * for error messages and cloning so its pages are handed back to the system */
 void PicocPlatformScanFile(Picoc *pc, const char *FileName)
 {
-    char *SourceStr = PlatformReadFile(pc, FileName);
+    int SourceLen;
+    const char *SourceStr;
+    struct SourceFileNode *SourceFile;
+
+    if (pc->TraceFileName != nullptr)
+        ProfileTraceBegin(pc, TableStrRegister(pc, FileName), "load");
+
+    SourceStr = PlatformReadFile(pc, FileName, &SourceLen);
+    SourceFile = pc->SourceFileList;
+    PicocParse(pc, FileName, SourceStr, SourceLen, true, false, false, true);
+
+    if (SourceFile->Mapped)
+        madvise((void *)SourceStr, SourceLen, MADV_DONTNEED);
+
+    if (pc->TraceFileName != nullptr)
+        ProfileTraceEnd(pc);
+}
+
+/* read and scan several files for definitions, in order. the files are all read and
+ * tokenised in parallel first */
+void PicocPlatformScanFiles(Picoc *pc, int NumFiles, char **FileNames)
+{
+    const char **SourceStr;
+    struct SourceFileNode **SourceFile;
+    int *SourceLen;
+    void **Tokens;
+    int Count;
+
+    if (NumFiles == 0)
+        return;
+
+    /* the arrays share one allocation which is kept in pc so cleanup can free it if a file fails */
+    pc->ScanFilesSpace = HeapAllocMem(pc, (sizeof(const char *) + sizeof(struct SourceFileNode *) + sizeof(void *) + sizeof(int)) * NumFiles);
+    if (pc->ScanFilesSpace == nullptr)
+        ProgramFailNoParser(pc, "out of memory\n");
 
-    /* ignore "#!/path/to/picoc" .. by replacing the "#!" with "//" */
-    if (SourceStr != nullptr && SourceStr[0] == '#' && SourceStr[1] == '!')
+    SourceStr = (const char **)pc->ScanFilesSpace;
+    SourceFile = (struct SourceFileNode **)&SourceStr[NumFiles];
+    Tokens = (void **)&SourceFile[NumFiles];
+    SourceLen = (int *)&Tokens[NumFiles];
+
+    for (Count = 0; Count < NumFiles; Count++)
     {
-        SourceStr[0] = '/';
-        SourceStr[1] = '/';
+        SourceStr[Count] = PlatformReadFile(pc, FileNames[Count], &SourceLen[Count]);
+        SourceFile[Count] = pc->SourceFileList;
+    }
+
+    if (pc->TraceFileName != nullptr)
+        ProfileTraceBegin(pc, "parallel lex", "lex");
+
+    ParallelLex(pc, NumFiles, FileNames, SourceStr, SourceLen, Tokens);
+
+    /* until they're parsed the tokens belong to their source files, which cleanup frees */
+    for (Count = 0; Count < NumFiles; Count++)
+        SourceFile[Count]->Tokens = Tokens[Count];
+
+    if (pc->TraceFileName != nullptr)
+        ProfileTraceEnd(pc);
+
+    for (Count = 0; Count < NumFiles; Count++)
+    {
+        if (pc->TraceFileName != nullptr)
+            ProfileTraceBegin(pc, TableStrRegister(pc, FileNames[Count]), "load");
+
+        SourceFile[Count]->Tokens = nullptr;
+        if (Tokens[Count] != nullptr)
+            ParseTokens(pc, FileNames[Count], SourceStr[Count], Tokens[Count], true, false, false, true);
+        else
+            PicocParse(pc, FileNames[Count], SourceStr[Count], SourceLen[Count], true, false, false, true);
+
+        if (SourceFile[Count]->Mapped)
+            madvise((void *)SourceStr[Count], SourceLen[Count], MADV_DONTNEED);
+
+        if (pc->TraceFileName != nullptr)
+            ProfileTraceEnd(pc);
     }
 
-    PicocParse(pc, FileName, SourceStr, strlen(SourceStr), true, false, true, true);
+    HeapFreeMem(pc, pc->ScanFilesSpace);
+    pc->ScanFilesSpace = nullptr;
 }
 
 /* exit the program */
@@ -0,0 +1,792 @@
+/* picoc function profiler - counts the calls to each function, including library
+ * functions, and measures the time spent in it with and without the functions it calls.
+ * there's also a sampling profiler which records the call stack at regular intervals, and
+ * line counters which count how many times each line of the source runs, a tracer
+ * which writes the beginning and end of calls, file loads and lexing for a trace viewer,
+ * and hardware event counts for loading, running and each function */
+
+#include <chrono>
+
+#include "picoc.h"
+#include "interpreter.h"
+
+#define PROFILE_STACK_INITIAL 64            /* profiled calls which can be running before the stack grows */
+#define PROFILE_FOLDED_MAX 1024             /* longest folded call stack, deeper stacks lose their outer calls */
+#define PROFILE_LINES_INITIAL 256           /* lines counted in a file before its counts grow */
+#define PROFILE_TRACE_INITIAL 4096          /* trace events buffered before the buffer grows */
+#define PROFILE_HOT_LINES 10                /* the number of hottest lines listed and marked in the line report */
+
+/* a line which ran, for sorting by the number of runs */
+struct ProfileHotLine
+{
+    struct LineCountFile *File;
+    int Line;
+};
+
+/* the time now in nanoseconds */
+static long long ProfileNow()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/* initialise the profiler. it's off until PicocProfileEnable() is called */
+void ProfileInit(Picoc *pc)
+{
+    int Count;
+
+    TableInitTable(&pc->ProfileTable, &pc->ProfileHashTable[0], PROFILE_TABLE_SIZE, true);
+    TableInitTable(&pc->ProfileSampleTable, &pc->ProfileSampleHashTable[0], PROFILE_SAMPLE_TABLE_SIZE, true);
+    pc->ProfileCalls = false;
+    pc->ProfileEnabled = false;
+    pc->ProfileFileName = nullptr;
+    pc->ProfileStack = nullptr;
+    pc->ProfileDepth = 0;
+    pc->ProfileStackSize = 0;
+    pc->ProfileSamplePending = false;
+    pc->ProfileSampleFileName = nullptr;
+    pc->LineCountFileName = nullptr;
+    pc->LineCountList = nullptr;
+    pc->LineCountLast = nullptr;
+    pc->TraceFileName = nullptr;
+    pc->TraceEvents = nullptr;
+    pc->NumTraceEvents = 0;
+    pc->TraceEventsSize = 0;
+    pc->TraceDepth = 0;
+    pc->ProfileCounting = false;
+    pc->ProfileCounterGroup = -1;
+    pc->ProfileCounterDepth = 0;
+    pc->ProfileCounterTotals = nullptr;
+    memset((void *)&pc->ProfileLoadCounts[0], '\0', sizeof(pc->ProfileLoadCounts));
+    memset((void *)&pc->ProfileRunCounts[0], '\0', sizeof(pc->ProfileRunCounts));
+    for (Count = 0; Count < NumProfileCounters; Count++)
+        pc->ProfileCounterFd[Count] = -1;
+}
+
+/* free the profile */
+void ProfileCleanup(Picoc *pc)
+{
+    if (pc->ProfileSampleFileName != nullptr)
+        PlatformSampleTimer(pc, 0);
+
+    VariableTableCleanup(pc, &pc->ProfileTable);
+    VariableTableCleanup(pc, &pc->ProfileSampleTable);
+    free(pc->ProfileStack);
+    pc->ProfileStack = nullptr;
+
+    while (pc->LineCountList != nullptr)
+    {
+        struct LineCountFile *Next = pc->LineCountList->Next;
+
+        free(pc->LineCountList->Counts);
+        free(pc->LineCountList);
+        pc->LineCountList = Next;
+    }
+
+    pc->LineCountLast = nullptr;
+    free(pc->TraceEvents);
+    pc->TraceEvents = nullptr;
+
+    if (pc->ProfileCounting)
+        PlatformCountersClose(pc);
+
+    pc->ProfileCounting = false;
+}
+
+/* start timing a phase of starting up */
+void ProfilePhaseStart(Picoc *pc)
+{
+    pc->PhaseStartNs = ProfileNow();
+    pc->PhaseStartAllocs = pc->HeapAllocCount;
+    pc->PhaseStartAllocBytes = pc->HeapAllocBytes;
+}
+
+/* note what the phase of starting up which began at the last ProfilePhaseStart() or
+ * ProfilePhaseEnd() took, and start timing the next phase */
+void ProfilePhaseEnd(Picoc *pc, const char *Name)
+{
+    struct StartupPhase *Phase;
+
+    if (pc->NumStartupPhases < STARTUP_PHASE_MAX)
+    {
+        Phase = &pc->StartupPhases[pc->NumStartupPhases++];
+        Phase->Name = Name;
+        Phase->Ns = ProfileNow() - pc->PhaseStartNs;
+        Phase->Allocs = pc->HeapAllocCount - pc->PhaseStartAllocs;
+        Phase->AllocBytes = pc->HeapAllocBytes - pc->PhaseStartAllocBytes;
+    }
+
+    ProfilePhaseStart(pc);
+}
+
+/* get the phases of starting up which have been timed: each step of PicocInitialise()
+ * and PicocIncludeAllSystemHeaders() if it's been called. returns the number of phases */
+int PicocStartupPhases(Picoc *pc, const struct StartupPhase **Phases)
+{
+    *Phases = &pc->StartupPhases[0];
+    return pc->NumStartupPhases;
+}
+
+/* start profiling every function call. if FileName isn't nullptr the profile is also
+ * written to it as tab-separated values when it's reported */
+void PicocProfileEnable(Picoc *pc, const char *FileName)
+{
+    pc->ProfileCalls = true;
+    pc->ProfileEnabled = true;
+    pc->ProfileFileName = FileName;
+}
+
+/* start tracing. the trace is written to FileName in the Chrome trace event format when
+ * the profile is reported */
+void PicocProfileTrace(Picoc *pc, const char *FileName)
+{
+    pc->ProfileCalls = true;
+    pc->TraceFileName = FileName;
+}
+
+/* add an event to the trace if we're tracing. Name must stay valid until the trace is written */
+static void ProfileTraceEvent(Picoc *pc, const char *Name, const char *Category)
+{
+    struct TraceEvent *Event;
+
+    if (pc->TraceFileName == nullptr)
+        return;
+
+    if (pc->NumTraceEvents == pc->TraceEventsSize)
+    {
+        int NewSize = (pc->TraceEventsSize == 0) ? PROFILE_TRACE_INITIAL : pc->TraceEventsSize * 2;
+        struct TraceEvent *NewEvents = (struct TraceEvent *)realloc(pc->TraceEvents, sizeof(struct TraceEvent) * NewSize);
+        if (NewEvents == nullptr)
+        {
+            /* stop tracing rather than fail the program */
+            pc->TraceFileName = nullptr;
+            return;
+        }
+
+        pc->TraceEvents = NewEvents;
+        pc->TraceEventsSize = NewSize;
+    }
+
+    pc->TraceDepth += (Name != nullptr) ? 1 : -1;
+    Event = &pc->TraceEvents[pc->NumTraceEvents++];
+    Event->Name = Name;
+    Event->Category = Category;
+    Event->TimeUs = ProfileNow() / 1000;
+}
+
+/* note the beginning of something to be traced, such as loading a file */
+void ProfileTraceBegin(Picoc *pc, const char *Name, const char *Category)
+{
+    ProfileTraceEvent(pc, Name, Category);
+}
+
+/* note the end of the innermost thing being traced */
+void ProfileTraceEnd(Picoc *pc)
+{
+    ProfileTraceEvent(pc, nullptr, nullptr);
+}
+
+/* start counting hardware events: cycles, instructions, branch misses and L1 data and
+ * last level cache misses. they're totalled for loading source and for running main(),
+ * and attributed to the functions which were running. if the machine or the OS can't
+ * count them the program runs as usual without them */
+void PicocProfileCounters(Picoc *pc)
+{
+    if (PlatformCountersOpen(pc) == 0)
+    {
+        fprintf(stderr, "hardware performance counters aren't available\n");
+        PlatformCountersClose(pc);
+        return;
+    }
+
+    pc->ProfileCounting = true;
+    pc->ProfileCalls = true;
+}
+
+/* start adding up the hardware events into Totals, unless an outer load or run
+ * already is, for instance a file being included while another's loading */
+void ProfileCountersBegin(Picoc *pc, long long *Totals)
+{
+    if (pc->ProfileCounterDepth++ > 0)
+        return;
+
+    pc->ProfileCounterTotals = Totals;
+    PlatformCountersRead(pc, &pc->ProfileCounterStart[0]);
+}
+
+/* stop adding up the hardware events if this ends the outermost load or run */
+void ProfileCountersEnd(Picoc *pc)
+{
+    long long Counts[NumProfileCounters];
+    int Count;
+
+    if (pc->ProfileCounterDepth == 0 || --pc->ProfileCounterDepth > 0)
+        return;
+
+    PlatformCountersRead(pc, &Counts[0]);
+    for (Count = 0; Count < NumProfileCounters; Count++)
+        pc->ProfileCounterTotals[Count] += Counts[Count] - pc->ProfileCounterStart[Count];
+}
+
+/* write a string as a JSON string */
+static void ProfileWriteJSONString(FILE *Out, const char *Str)
+{
+    fputc('"', Out);
+    for (; *Str != '\0'; Str++)
+    {
+        if (*Str == '"' || *Str == '\\')
+            fprintf(Out, "\\%c", *Str);
+        else if ((unsigned char)*Str < ' ')
+            fprintf(Out, "\\u%04x", *Str);
+        else
+            fputc(*Str, Out);
+    }
+    fputc('"', Out);
+}
+
+/* write the buffered trace events in the Chrome trace event format */
+static void ProfileWriteTrace(Picoc *pc)
+{
+    int Count;
+    int Pid = getpid();
+    FILE *Out = fopen(pc->TraceFileName, "w");
+
+    if (Out == nullptr)
+    {
+        fprintf(stderr, "can't write the trace to %s\n", pc->TraceFileName);
+        return;
+    }
+
+    fprintf(Out, "{\"traceEvents\":[");
+    for (Count = 0; Count < pc->NumTraceEvents; Count++)
+    {
+        struct TraceEvent *Event = &pc->TraceEvents[Count];
+
+        fprintf(Out, (Count == 0) ? "\n" : ",\n");
+        if (Event->Name != nullptr)
+        {
+            fprintf(Out, "{\"name\":");
+            ProfileWriteJSONString(Out, Event->Name);
+            fprintf(Out, ",\"cat\":\"%s\",\"ph\":\"B\",\"ts\":%lld,\"pid\":%d,\"tid\":1}", Event->Category, Event->TimeUs, Pid);
+        }
+        else
+            fprintf(Out, "{\"ph\":\"E\",\"ts\":%lld,\"pid\":%d,\"tid\":1}", Event->TimeUs, Pid);
+    }
+
+    fprintf(Out, "\n],\"displayTimeUnit\":\"ms\"}\n");
+    fclose(Out);
+}
+
+/* start sampling the call stack. the samples are written to FileName as folded stacks,
+ * one line per distinct stack with its sample count, when the profile is reported */
+void PicocProfileSample(Picoc *pc, const char *FileName)
+{
+    pc->ProfileSampleFileName = FileName;
+    PlatformSampleTimer(pc, PROFILE_SAMPLE_INTERVAL_US);
+}
+
+/* take a sample asked for by the sampling timer. the signal handler only sets a flag
+ * since the interpreter state may be inconsistent when it runs, so the sample is
+ * taken at the start of the next statement. the stack is folded into a single string,
+ * outermost call first, with the statement's file and line as the innermost frame */
+void ProfileSample(struct ParseState *Parser)
+{
+    Picoc *pc = Parser->pc;
+    char Folded[PROFILE_FOLDED_MAX];
+    int Pos = PROFILE_FOLDED_MAX;
+    int Len;
+    struct StackFrame *Frame;
+    struct Value *CountValue;
+    char *Key;
+
+    pc->ProfileSamplePending = false;
+
+    /* build the string backwards from the innermost frame */
+    Len = snprintf(&Folded[0], PROFILE_FOLDED_MAX, "%s:%d", Parser->FileName, LexNextTokenLine(Parser));
+    if (Len >= PROFILE_FOLDED_MAX)
+        Len = PROFILE_FOLDED_MAX - 1;
+
+    Pos -= Len + 1;
+    memmove(&Folded[Pos], &Folded[0], Len + 1);
+    for (Frame = pc->TopStackFrame; Frame != nullptr; Frame = Frame->PreviousStackFrame)
+    {
+        Len = strlen(Frame->FuncName);
+        if (Len + 1 > Pos)
+            break;
+
+        Folded[--Pos] = ';';
+        Pos -= Len;
+        memcpy(&Folded[Pos], Frame->FuncName, Len);
+    }
+
+    Key = TableStrRegister(pc, &Folded[Pos]);
+    if (TableGet(&pc->ProfileSampleTable, Key, &CountValue, nullptr, nullptr, nullptr))
+        CountValue->Val->UnsignedLongInteger++;
+    else
+    {
+        CountValue = VariableAllocValueFromType(pc, Parser, &pc->UnsignedLongType, false, nullptr, true);
+        CountValue->Val->UnsignedLongInteger = 1;
+        TableSet(pc, &pc->ProfileSampleTable, Key, CountValue, nullptr, 0, 0);
+    }
+}
+
+/* write the sampled call stacks in the folded format taken by flame graph tools */
+static void ProfileWriteSamples(Picoc *pc)
+{
+    struct TableEntry *TEntry;
+    int Count;
+    FILE *Out;
+
+    PlatformSampleTimer(pc, 0);
+    Out = fopen(pc->ProfileSampleFileName, "w");
+    if (Out == nullptr)
+    {
+        fprintf(stderr, "can't write the profile samples to %s\n", pc->ProfileSampleFileName);
+        return;
+    }
+
+    for (Count = 0; Count < pc->ProfileSampleTable.Size; Count++)
+    {
+        for (TEntry = pc->ProfileSampleTable.HashTable[Count]; TEntry != nullptr; TEntry = TEntry->Next)
+            fprintf(Out, "%s %lu\n", TEntry->p.v.Key, TEntry->p.v.Val->Val->UnsignedLongInteger);
+    }
+
+    fclose(Out);
+}
+
+/* start counting how many times each line runs. an annotated copy of the source is
+ * written to FileName when the profile is reported */
+void PicocProfileLines(Picoc *pc, const char *FileName)
+{
+    pc->LineCountFileName = FileName;
+}
+
+/* find the line counts of the parser's file, making sure there's a count for Line */
+static struct LineCountFile *ProfileLineCountFile(struct ParseState *Parser, int Line)
+{
+    Picoc *pc = Parser->pc;
+    struct LineCountFile *File;
+
+    for (File = pc->LineCountList; File != nullptr && File->FileName != Parser->FileName; File = File->Next)
+    {}
+
+    if (File == nullptr)
+    {
+        File = (struct LineCountFile *)calloc(1, sizeof(struct LineCountFile));
+        if (File == nullptr)
+            ProgramFail(Parser, "out of memory");
+
+        File->FileName = Parser->FileName;
+        File->SourceText = Parser->SourceText;
+        File->Next = pc->LineCountList;
+        pc->LineCountList = File;
+    }
+
+    if (Line >= File->NumLines)
+    {
+        int NewLines = (File->NumLines == 0) ? PROFILE_LINES_INITIAL : File->NumLines;
+        unsigned long *NewCounts;
+
+        while (NewLines <= Line)
+            NewLines *= 2;
+
+        NewCounts = (unsigned long *)realloc(File->Counts, sizeof(unsigned long) * NewLines);
+        if (NewCounts == nullptr)
+            ProgramFail(Parser, "out of memory");
+
+        memset((void *)&NewCounts[File->NumLines], '\0', sizeof(unsigned long) * (NewLines - File->NumLines));
+        File->Counts = NewCounts;
+        File->NumLines = NewLines;
+    }
+
+    pc->LineCountLast = File;
+    return File;
+}
+
+/* count a run of the statement the parser is at */
+void ProfileCountLine(struct ParseState *Parser)
+{
+    struct LineCountFile *File = Parser->pc->LineCountLast;
+    int Line = LexNextTokenLine(Parser);
+
+    if (File == nullptr || File->FileName != Parser->FileName || Line >= File->NumLines)
+        File = ProfileLineCountFile(Parser, Line);
+
+    File->Counts[Line]++;
+}
+
+/* order lines by decreasing number of runs */
+static int ProfileHotLineCompare(const void *A, const void *B)
+{
+    const struct ProfileHotLine *LineA = (const struct ProfileHotLine *)A;
+    const struct ProfileHotLine *LineB = (const struct ProfileHotLine *)B;
+    unsigned long CountA = LineA->File->Counts[LineA->Line];
+    unsigned long CountB = LineB->File->Counts[LineB->Line];
+
+    return (CountA < CountB) - (CountA > CountB);
+}
+
+/* write the line counts as a list of the hottest lines followed by each file's source
+ * with the number of runs beside each line. the hottest lines are marked with ">>" */
+static void ProfileWriteLineCounts(Picoc *pc)
+{
+    struct LineCountFile *File;
+    struct ProfileHotLine *HotLines;
+    int NumHotLines = 0;
+    int LastLine;
+    int Line;
+    int Count;
+    FILE *Out;
+
+    for (File = pc->LineCountList; File != nullptr; File = File->Next)
+    {
+        for (Line = 0; Line < File->NumLines; Line++)
+        {
+            if (File->Counts[Line] != 0)
+                NumHotLines++;
+        }
+    }
+
+    HotLines = (struct ProfileHotLine *)malloc(sizeof(struct ProfileHotLine) * (NumHotLines + 1));
+    if (HotLines == nullptr)
+        return;
+
+    NumHotLines = 0;
+    for (File = pc->LineCountList; File != nullptr; File = File->Next)
+    {
+        for (Line = 0; Line < File->NumLines; Line++)
+        {
+            if (File->Counts[Line] != 0)
+            {
+                HotLines[NumHotLines].File = File;
+                HotLines[NumHotLines].Line = Line;
+                NumHotLines++;
+            }
+        }
+    }
+
+    qsort(HotLines, NumHotLines, sizeof(struct ProfileHotLine), ProfileHotLineCompare);
+    if (NumHotLines > PROFILE_HOT_LINES)
+        NumHotLines = PROFILE_HOT_LINES;
+
+    Out = fopen(pc->LineCountFileName, "w");
+    if (Out == nullptr)
+    {
+        fprintf(stderr, "can't write the line counts to %s\n", pc->LineCountFileName);
+        free(HotLines);
+        return;
+    }
+
+    fprintf(Out, "hottest lines:\n");
+    for (Count = 0; Count < NumHotLines; Count++)
+        fprintf(Out, "%12lu  %s:%d\n", HotLines[Count].File->Counts[HotLines[Count].Line], HotLines[Count].File->FileName, HotLines[Count].Line);
+
+    for (File = pc->LineCountList; File != nullptr; File = File->Next)
+    {
+        const char *Text = File->SourceText;
+
+        for (LastLine = File->NumLines - 1; LastLine > 0 && File->Counts[LastLine] == 0; LastLine--)
+        {}
+
+        fprintf(Out, "\n%s:\n", File->FileName);
+        for (Line = 1; (Text != nullptr && *Text != '\0') || Line <= LastLine; Line++)
+        {
+            unsigned long Runs = (Line <= LastLine) ? File->Counts[Line] : 0;
+            const char *LineEnd = Text;
+            const char *Mark = "";
+
+            for (Count = 0; Count < NumHotLines; Count++)
+            {
+                if (HotLines[Count].File == File && HotLines[Count].Line == Line)
+                    Mark = ">>";
+            }
+
+            if (Text != nullptr)
+            {
+                while (*LineEnd != '\0' && *LineEnd != '\n')
+                    LineEnd++;
+            }
+            else if (Runs == 0)
+                continue;
+
+            if (Runs != 0)
+                fprintf(Out, "%12lu %2s %5d  ", Runs, Mark, Line);
+            else
+                fprintf(Out, "%12s %2s %5d  ", "", "", Line);
+
+            if (Text != nullptr)
+            {
+                fprintf(Out, "%.*s", (int)(LineEnd - Text), Text);
+                Text = (*LineEnd == '\n') ? LineEnd + 1 : LineEnd;
+            }
+
+            fprintf(Out, "\n");
+        }
+    }
+
+    fclose(Out);
+    free(HotLines);
+}
+
+/* find a function's profile, adding it if it's not there yet */
+static struct ProfileEntry *ProfileGetEntry(struct ParseState *Parser, const char *FuncName)
+{
+    Picoc *pc = Parser->pc;
+    struct Value *EntryValue;
+    struct ProfileEntry *Entry;
+
+    if (TableGet(&pc->ProfileTable, FuncName, &EntryValue, nullptr, nullptr, nullptr))
+        return (struct ProfileEntry *)EntryValue->Val;
+
+    EntryValue = VariableAllocValueAndData(pc, Parser, sizeof(struct ProfileEntry), false, nullptr, true);
+    EntryValue->Typ = &pc->VoidType;
+    Entry = (struct ProfileEntry *)EntryValue->Val;
+    Entry->FuncName = FuncName;
+    Entry->Calls = 0;
+    Entry->Active = 0;
+    Entry->InclusiveNs = 0;
+    Entry->SelfNs = 0;
+    memset((void *)&Entry->SelfCounts[0], '\0', sizeof(Entry->SelfCounts));
+    TableSet(pc, &pc->ProfileTable, (char *)FuncName, EntryValue, nullptr, 0, 0);
+
+    return Entry;
+}
+
+/* note the start of a call to a function. IsLibrary is true for a library function */
+void ProfileEnter(struct ParseState *Parser, const char *FuncName, int IsLibrary)
+{
+    Picoc *pc = Parser->pc;
+    struct ProfileEntry *Entry = nullptr;
+    struct ProfileFrame *Frame;
+
+    if (pc->ProfileDepth == pc->ProfileStackSize)
+    {
+        int NewSize = (pc->ProfileStackSize == 0) ? PROFILE_STACK_INITIAL : pc->ProfileStackSize * 2;
+        struct ProfileFrame *NewStack = (struct ProfileFrame *)realloc(pc->ProfileStack, sizeof(struct ProfileFrame) * NewSize);
+        if (NewStack == nullptr)
+            ProgramFail(Parser, "out of memory");
+
+        pc->ProfileStack = NewStack;
+        pc->ProfileStackSize = NewSize;
+    }
+
+    if (pc->ProfileEnabled || pc->ProfileCounting)
+    {
+        Entry = ProfileGetEntry(Parser, FuncName);
+        Entry->Calls++;
+        Entry->Active++;
+    }
+
+    ProfileTraceEvent(pc, FuncName, IsLibrary ? "library" : "function");
+    Frame = &pc->ProfileStack[pc->ProfileDepth++];
+    Frame->Entry = Entry;
+    Frame->ChildNs = 0;
+    if (pc->ProfileCounting)
+    {
+        memset((void *)&Frame->ChildCounts[0], '\0', sizeof(Frame->ChildCounts));
+        PlatformCountersRead(pc, &Frame->StartCounts[0]);
+    }
+
+    Frame->StartNs = ProfileNow();
+}
+
+/* note the end of the innermost profiled call */
+void ProfileLeave(Picoc *pc)
+{
+    struct ProfileFrame *Frame = &pc->ProfileStack[--pc->ProfileDepth];
+    long long Elapsed = ProfileNow() - Frame->StartNs;
+    long long Counts[NumProfileCounters];
+    int Count;
+
+    ProfileTraceEvent(pc, nullptr, nullptr);
+    if (Frame->Entry == nullptr)
+        return;
+
+    if (pc->ProfileCounting)
+    {
+        PlatformCountersRead(pc, &Counts[0]);
+        for (Count = 0; Count < NumProfileCounters; Count++)
+        {
+            Counts[Count] -= Frame->StartCounts[Count];
+            Frame->Entry->SelfCounts[Count] += Counts[Count] - Frame->ChildCounts[Count];
+            if (pc->ProfileDepth > 0)
+                pc->ProfileStack[pc->ProfileDepth-1].ChildCounts[Count] += Counts[Count];
+        }
+    }
+
+    /* time in a recursive call is already included in the outermost call */
+    Frame->Entry->Active--;
+    if (Frame->Entry->Active == 0)
+        Frame->Entry->InclusiveNs += Elapsed;
+
+    Frame->Entry->SelfNs += Elapsed - Frame->ChildNs;
+    if (pc->ProfileDepth > 0)
+        pc->ProfileStack[pc->ProfileDepth-1].ChildNs += Elapsed;
+}
+
+/* order profile entries by decreasing self time */
+static int ProfileCompare(const void *A, const void *B)
+{
+    long long SelfA = (*(struct ProfileEntry **)A)->SelfNs;
+    long long SelfB = (*(struct ProfileEntry **)B)->SelfNs;
+
+    return (SelfA < SelfB) - (SelfA > SelfB);
+}
+
+/* order profile entries by decreasing self cycles */
+static int ProfileCompareCycles(const void *A, const void *B)
+{
+    long long CyclesA = (*(struct ProfileEntry **)A)->SelfCounts[CounterCycles];
+    long long CyclesB = (*(struct ProfileEntry **)B)->SelfCounts[CounterCycles];
+
+    return (CyclesA < CyclesB) - (CyclesA > CyclesB);
+}
+
+/* print a line of hardware event counts, with instructions per cycle after the
+ * instructions. counters which aren't available are shown as "-" */
+static void ProfilePrintCounts(Picoc *pc, long long *Counts)
+{
+    int Count;
+
+    for (Count = 0; Count < NumProfileCounters; Count++)
+    {
+        if (pc->ProfileCounterFd[Count] >= 0)
+            fprintf(stderr, " %14lld", Counts[Count]);
+        else
+            fprintf(stderr, " %14s", "-");
+
+        if (Count == CounterInstructions)
+        {
+            if (pc->ProfileCounterFd[CounterCycles] >= 0 && pc->ProfileCounterFd[CounterInstructions] >= 0 && Counts[CounterCycles] > 0)
+                fprintf(stderr, " %6.2f", (double)Counts[CounterInstructions] / Counts[CounterCycles]);
+            else
+                fprintf(stderr, " %6s", "-");
+        }
+    }
+
+    fprintf(stderr, "\n");
+}
+
+/* print the hardware events counted while loading and running, and in each function
+ * excluding the functions it called, sorted by cycles. a low number of instructions
+ * per cycle with many cache misses points at memory, with many branch misses at
+ * the interpreter's dispatch */
+static void ProfileReportCounters(Picoc *pc, struct ProfileEntry **Entries, int NumEntries)
+{
+    static const char *Header = "%-24s %12s %14s %14s %6s %14s %14s %14s\n";
+    long long Totals[NumProfileCounters];
+    int Count;
+
+    for (Count = 0; Count < NumProfileCounters; Count++)
+        Totals[Count] = pc->ProfileLoadCounts[Count] + pc->ProfileRunCounts[Count];
+
+    fprintf(stderr, "\n");
+    fprintf(stderr, Header, "hardware events", "", "cycles", "instructions", "IPC", "branch misses", "L1d misses", "LLC misses");
+    fprintf(stderr, "%-24s %12s", "load", "");
+    ProfilePrintCounts(pc, &pc->ProfileLoadCounts[0]);
+    fprintf(stderr, "%-24s %12s", "run main()", "");
+    ProfilePrintCounts(pc, &pc->ProfileRunCounts[0]);
+    fprintf(stderr, "%-24s %12s", "total", "");
+    ProfilePrintCounts(pc, &Totals[0]);
+
+    qsort(Entries, NumEntries, sizeof(struct ProfileEntry *), ProfileCompareCycles);
+    fprintf(stderr, "\n");
+    fprintf(stderr, Header, "function", "calls", "self cycles", "instructions", "IPC", "branch misses", "L1d misses", "LLC misses");
+    for (Count = 0; Count < NumEntries; Count++)
+    {
+        fprintf(stderr, "%-24s %12lu", Entries[Count]->FuncName, Entries[Count]->Calls);
+        ProfilePrintCounts(pc, &Entries[Count]->SelfCounts[0]);
+    }
+}
+
+/* print the profile to stderr sorted by self time, and write it to the profile file if
+ * there is one. calls which are still running, for instance because the program
+ * called exit(), are ended now. sampled call stacks, line counts and the trace are
+ * written to their files, and hardware event counts are printed */
+void PicocProfileReport(Picoc *pc)
+{
+    struct ProfileEntry **Entries;
+    struct TableEntry *TEntry;
+    long long TotalNs = 0;
+    int NumEntries = 0;
+    int Count;
+    FILE *Out;
+
+    while (pc->ProfileDepth > 0)
+        ProfileLeave(pc);
+
+    if (pc->ProfileSampleFileName != nullptr)
+        ProfileWriteSamples(pc);
+
+    if (pc->LineCountFileName != nullptr)
+        ProfileWriteLineCounts(pc);
+
+    if (pc->TraceFileName != nullptr)
+    {
+        /* end anything else which was cut short */
+        while (pc->TraceDepth > 0)
+            ProfileTraceEnd(pc);
+
+        ProfileWriteTrace(pc);
+    }
+
+    while (pc->ProfileCounterDepth > 0)
+        ProfileCountersEnd(pc);
+
+    if (!pc->ProfileEnabled && !pc->ProfileCounting)
+        return;
+
+    for (Count = 0; Count < pc->ProfileTable.Size; Count++)
+    {
+        for (TEntry = pc->ProfileTable.HashTable[Count]; TEntry != nullptr; TEntry = TEntry->Next)
+            NumEntries++;
+    }
+
+    Entries = (struct ProfileEntry **)malloc(sizeof(struct ProfileEntry *) * (NumEntries + 1));
+    if (Entries == nullptr)
+        return;
+
+    NumEntries = 0;
+    for (Count = 0; Count < pc->ProfileTable.Size; Count++)
+    {
+        for (TEntry = pc->ProfileTable.HashTable[Count]; TEntry != nullptr; TEntry = TEntry->Next)
+        {
+            Entries[NumEntries] = (struct ProfileEntry *)TEntry->p.v.Val->Val;
+            TotalNs += Entries[NumEntries]->SelfNs;
+            NumEntries++;
+        }
+    }
+
+    PlatformFlush(pc->CStdOut);
+    fflush(stdout);
+    if (pc->ProfileCounting)
+        ProfileReportCounters(pc, Entries, NumEntries);
+
+    if (!pc->ProfileEnabled)
+    {
+        free(Entries);
+        return;
+    }
+
+    qsort(Entries, NumEntries, sizeof(struct ProfileEntry *), ProfileCompare);
+    fprintf(stderr, "\n%-24s %12s %14s %14s %7s\n", "function", "calls", "inclusive ms", "self ms", "self %");
+    for (Count = 0; Count < NumEntries; Count++)
+        fprintf(stderr, "%-24s %12lu %14.3f %14.3f %6.1f%%\n", Entries[Count]->FuncName, Entries[Count]->Calls,
+                Entries[Count]->InclusiveNs / 1e6, Entries[Count]->SelfNs / 1e6, (TotalNs > 0) ? Entries[Count]->SelfNs * 100.0 / TotalNs : 0.0);
+
+    if (pc->ProfileFileName != nullptr)
+    {
+        Out = fopen(pc->ProfileFileName, "w");
+        if (Out == nullptr)
+            fprintf(stderr, "can't write the profile to %s\n", pc->ProfileFileName);
+        else
+        {
+            fprintf(Out, "function\tcalls\tinclusive_ns\tself_ns\n");
+            for (Count = 0; Count < NumEntries; Count++)
+                fprintf(Out, "%s\t%lu\t%lld\t%lld\n", Entries[Count]->FuncName, Entries[Count]->Calls, Entries[Count]->InclusiveNs, Entries[Count]->SelfNs);
+
+            fclose(Out);
+        }
+    }
+
+    free(Entries);
+}
@@ -0,0 +1,11 @@
+/* variables declared in sibling blocks don't clash */
+#include <stdio.h>
+int main()
+{
+    int i;
+    for (i = 0; i < 2; i++) { int t = i; printf("%d\n", t); }
+    for (i = 0; i < 2; i++) { int t = i * 2; printf("%d\n", t); }
+    { int u = 1; }
+    { int u = 2; printf("u=%d\n", u); }
+    return 0;
+}
@@ -0,0 +1,23 @@
+/* folded int and char constants are read back correctly each time round a loop */
+#include <stdio.h>
+
+#define CH 'q'
+#define SUM (2 + 3)
+enum { A = 3, B };
+
+int main()
+{
+    int Count;
+    int Total = 0;
+    char Ch = 0;
+
+    for (Count = 0; Count < 3; Count++)
+    {
+        Total += A;
+        Total += B * SUM;
+        Ch = CH;
+    }
+
+    printf("%d %c\n", Total, Ch);
+    return 0;
+}
@@ -0,0 +1,181 @@
+/* tests of picoc's host interface. each test prints its results so the output can be
+ * compared with host_api.expect by run-tests.sh.
+ *
+ * build it with:   g++ -DUNIX_HOST -I. -o picoc-host-tests tests/host_api.cpp \
+ *                      $(ls *.cpp | grep -v '^picoc.cpp$') cstdlib/[a-z]*.cpp -lm -lreadline -pthread
+ * run it with:     tests/run-tests.sh ./picoc ./picoc-host-tests */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "picoc.h"
+
+#define HOST_TEST_STACK_SIZE (128 * 1024)
+#define HOST_TEST_MAP_CALLS 1000
+
+/* a function whose struct return value doesn't fit in a union AnyValue */
+#define HOST_TEST_BIG_STRUCT "struct big { int a[64]; }; struct big mkbig(int n) { struct big b; b.a[0] = n; return b; }"
+
+/* a host value the script can read but not write, which the host changes between calls */
+static int Tick;
+
+/* parse a script into pc, keeping its tokens */
+static void HostTestParse(Picoc *pc, const char *FileName, const char *Source)
+{
+    PicocParse(pc, FileName, Source, strlen(Source), true, false, false, false);
+}
+
+/* call a function which has no parameters and returns an int */
+static int HostTestCall(Picoc *pc, const char *FuncName)
+{
+    union AnyValue Result;
+
+    PicocCallFunctionBatch(pc, FuncName, 1, nullptr, &Result);
+    return Result.Integer;
+}
+
+/* a read-only platform variable mustn't be folded into the tokens as a constant */
+static void TestReadOnlyPlatformVar()
+{
+    Picoc pc;
+    int First;
+    int Second;
+
+    PicocInitialise(&pc, HOST_TEST_STACK_SIZE);
+    if (PicocPlatformSetExitPoint(&pc))
+    {
+        printf("read-only platform var: failed\n");
+        PicocCleanup(&pc);
+        return;
+    }
+
+    VariableDefinePlatformVar(&pc, nullptr, "Tick", &pc.IntType, (union AnyValue *)&Tick, false);
+    HostTestParse(&pc, "tick.c", "int now() { return Tick * 10 + 1; }");
+
+    Tick = 1;
+    First = HostTestCall(&pc, "now");
+    Tick = 5;
+    Second = HostTestCall(&pc, "now");
+    printf("read-only platform var: %d %d\n", First, Second);
+
+    PicocCleanup(&pc);
+}
+
+/* a snippet whose tokens are freed straight after it runs can have its tokens reused by the
+ * next one, which mustn't pick up the first one's static variable */
+static void TestStaticReusedTokens()
+{
+    Picoc pc;
+    const char *First = "static int aa = 5; printf(\"static in reused tokens: %d\\n\", aa);";
+    const char *Second = "static int bb = 7; printf(\"static in reused tokens: %d\\n\", bb);";
+
+    PicocInitialise(&pc, HOST_TEST_STACK_SIZE);
+    PicocIncludeAllSystemHeaders(&pc);
+    if (PicocPlatformSetExitPoint(&pc))
+    {
+        printf("static in reused tokens: failed\n");
+        PicocCleanup(&pc);
+        return;
+    }
+
+    PicocParse(&pc, "snip", First, strlen(First), true, true, false, false);
+    PicocParse(&pc, "snip", Second, strlen(Second), true, true, false, false);
+    PicocCleanup(&pc);
+}
+
+/* a batch call runs a function once per argument tuple */
+static void TestCallFunctionBatch()
+{
+    Picoc pc;
+    union AnyValue Args[8];
+    union AnyValue Results[4];
+    int Count;
+
+    PicocInitialise(&pc, HOST_TEST_STACK_SIZE);
+    if (PicocPlatformSetExitPoint(&pc))
+    {
+        printf("batch call: failed\n");
+        PicocCleanup(&pc);
+        return;
+    }
+
+    HostTestParse(&pc, "batch.c", "int mul(int x, int y) { int z = x * y; return z + 1; }");
+    for (Count = 0; Count < 4; Count++)
+    {
+        Args[Count * 2].Integer = Count;
+        Args[Count * 2 + 1].Integer = 10;
+    }
+
+    PicocCallFunctionBatch(&pc, "mul", 4, &Args[0], &Results[0]);
+    printf("batch call: %d %d %d %d\n", Results[0].Integer, Results[1].Integer, Results[2].Integer, Results[3].Integer);
+    PicocCleanup(&pc);
+}
+
+/* a batch call can't return a struct which is too big for its result slot */
+static void TestCallFunctionBatchBigStruct()
+{
+    Picoc pc;
+    union AnyValue Args[1];
+    union AnyValue Results[1];
+
+    PicocInitialise(&pc, HOST_TEST_STACK_SIZE);
+    if (PicocPlatformSetExitPoint(&pc))
+    {
+        printf("batch call returning a big struct: rejected\n");
+        PicocCleanup(&pc);
+        return;
+    }
+
+    HostTestParse(&pc, "big.c", HOST_TEST_BIG_STRUCT);
+    Args[0].Integer = 1;
+    PicocCallFunctionBatch(&pc, "mkbig", 1, &Args[0], &Results[0]);
+    printf("batch call returning a big struct: called\n");
+    PicocCleanup(&pc);
+}
+
+/* a parallel map gives the same results as calling the function in order */
+static void TestParallelMap()
+{
+    Picoc pc;
+    static union AnyValue Args[HOST_TEST_MAP_CALLS];
+    static union AnyValue Results[HOST_TEST_MAP_CALLS];
+    int Count;
+    int Wrong = 0;
+    int Done;
+
+    PicocInitialise(&pc, HOST_TEST_STACK_SIZE);
+    if (PicocPlatformSetExitPoint(&pc))
+    {
+        printf("parallel map: failed\n");
+        PicocCleanup(&pc);
+        return;
+    }
+
+    HostTestParse(&pc, "map.c", "int tri(int n) { int t = 0; while (n > 0) t += n--; return t; }");
+    for (Count = 0; Count < HOST_TEST_MAP_CALLS; Count++)
+        Args[Count].Integer = Count;
+
+    Done = PicocParallelMap(&pc, "tri", HOST_TEST_MAP_CALLS, &Args[0], &Results[0], 4);
+    for (Count = 0; Count < HOST_TEST_MAP_CALLS; Count++)
+    {
+        if (Results[Count].Integer != Count * (Count + 1) / 2)
+            Wrong++;
+    }
+
+    printf("parallel map: %d %d wrong\n", Done, Wrong);
+
+    HostTestParse(&pc, "big.c", HOST_TEST_BIG_STRUCT);
+    Done = PicocParallelMap(&pc, "mkbig", 4, &Args[0], &Results[0], 2);
+    printf("parallel map returning a big struct: %d\n", Done);
+    PicocCleanup(&pc);
+}
+
+int main()
+{
+    TestReadOnlyPlatformVar();
+    TestStaticReusedTokens();
+    TestCallFunctionBatch();
+    TestCallFunctionBatchBigStruct();
+    TestParallelMap();
+    return 0;
+}
@@ -0,0 +1,33 @@
+/* a macro call is expanded in place, so the tokens round it bind to the expansion as they
+ * would in C, and each call site's cached expansion is used again round a loop */
+#include <stdio.h>
+
+#define PLUS1(x) x + 1
+#define TWICE(x) x + x
+#define SQ(x) x * x
+#define LEN(a) (sizeof(a) / sizeof(a[0]))
+#define ADD(a, b) a + b
+
+int main()
+{
+    int Table[5];
+    int Count;
+    int Total = 0;
+    int i = 3;
+
+    printf("%d\n", PLUS1(2) * 3);
+    printf("%d\n", TWICE(i) * 2);
+    printf("%d\n", SQ(i+1) - TWICE(i+1));
+    printf("%d %d\n", (int)sizeof(SQ(3)), (int)LEN(Table));
+    printf("%d\n", ADD(SQ(2),
+                       PLUS1(i)) * 2);
+
+    for (Count = 0; Count < 4; Count++)
+    {
+        Total += SQ(Count) * 10;
+        Total += PLUS1(Count);
+    }
+
+    printf("%d\n", Total);
+    return 0;
+}
@@ -0,0 +1,39 @@
+/* a NULL pointer on the left of && || and ?: stops the right hand side being evaluated */
+#include <stdio.h>
+
+struct Node
+{
+    int Value;
+    struct Node *Next;
+};
+
+int main()
+{
+    struct Node Last;
+    struct Node First;
+    struct Node *Node;
+    int Count = 0;
+
+    Last.Value = 2;
+    Last.Next = NULL;
+    First.Value = 1;
+    First.Next = &Last;
+
+    for (Node = &First; Node != NULL; Node = Node->Next)
+    {
+        if (Node->Next && Node->Next->Value > 1)
+            printf("%d is followed by %d\n", Node->Value, Node->Next->Value);
+
+        if (!Node->Next || Node->Next->Value == 0)
+            printf("%d is last\n", Node->Value);
+
+        if (Node->Next || Count++)
+            printf("%d has a next\n", Node->Value);
+
+        printf("%d then %d\n", Node->Value, Node->Next ? Node->Next->Value : -1);
+    }
+
+    Node = NULL;
+    printf("%d %d %d\n", Node && Node->Value, Node || Count, Node ? Node->Value : 0);
+    return 0;
+}
@@ -0,0 +1,33 @@
+#!/bin/sh
+# run each test script under picoc and compare its output with the .expect file beside it.
+# .c tests are run as programs and .input tests are fed to interactive mode. the host
+# interface tests in host_api.cpp are run too if their program is given.
+# usage: tests/run-tests.sh [<picoc> [<host tests>]]
+# build picoc with -fsanitize=address to check the tests for memory errors too
+
+PICOC=${1:-./picoc}
+HOST_TESTS=$2
+DIR=$(dirname "$0")
+FAILED=0
+
+for TEST in "$DIR"/*.c "$DIR"/*.input ${HOST_TESTS:+"$DIR"/host_api.cpp}
+do
+    [ -f "$TEST" ] || continue
+    NAME=${TEST%.*}
+    case "$TEST" in
+        *.input) OUTPUT=$("$PICOC" -i < "$TEST" 2>&1) ;;
+        *.cpp)   OUTPUT=$("$HOST_TESTS" 2>&1) ;;
+        *)       OUTPUT=$("$PICOC" "$TEST" 2>&1) ;;
+    esac
+
+    if [ "$OUTPUT" = "$(cat "$NAME.expect")" ]
+    then
+        echo "ok      $(basename "$NAME")"
+    else
+        echo "FAILED  $(basename "$NAME")"
+        echo "$OUTPUT" | diff "$NAME.expect" - | head -20
+        FAILED=$((FAILED + 1))
+    fi
+done
+
+exit $FAILED
@@ -23,6 +23,7 @@ struct ValueType *TypeAdd(Picoc *pc, struct ParseState *Parser, struct ValueType
 	NewType->OnHeap = true;
 	NewType->Next = ParentType->DerivedTypeList;
 	ParentType->DerivedTypeList = NewType;
+	pc->NumTypeNodes++;
 
 	return NewType;
 }
@@ -282,6 +283,71 @@ struct ValueType *TypeCreateOpaqueStruct(Picoc *pc, struct ParseState *Parser, c
     return Typ;
 }
 
+/* find or make the type of the interpreter To which matches one of pc's types, so values can be
+ * copied from one interpreter to the other. a struct or union gets pc's members if it has none */
+struct ValueType *TypeCopy(Picoc *pc, Picoc *To, struct ValueType *Typ)
+{
+    struct ValueType *NewType;
+    struct TableEntry *Entry;
+    struct Value *MemberValue;
+    int Count;
+
+    if (Typ == nullptr)
+        return nullptr;
+
+    if ((char *)Typ >= (char *)pc && (char *)Typ < (char *)(pc + 1))
+    {
+        /* a base type is at the same place in To. an enum definition gives the int type members */
+        NewType = (struct ValueType *)((char *)To + ((char *)Typ - (char *)pc));
+        if (Typ->Members == &pc->GlobalTable)
+            NewType->Members = &To->GlobalTable;
+
+        return NewType;
+    }
+
+    NewType = TypeGetMatching(To, nullptr, TypeCopy(pc, To, Typ->FromType), Typ->Base, Typ->ArraySize, TableStrRegister(To, Typ->Identifier), true);
+    if (Typ->Members == nullptr || NewType->Members != nullptr)
+        return NewType;
+
+    /* the table goes in first so a member which points back to this type finds it already copied */
+    NewType->Members = (Table*)VariableAlloc(To, nullptr, sizeof(struct Table) + STRUCT_TABLE_SIZE * sizeof(struct TableEntry), true);
+    NewType->Members->HashTable = (struct TableEntry **)((char *)NewType->Members + sizeof(struct Table));
+    TableInitTable(NewType->Members, (struct TableEntry **)((char *)NewType->Members + sizeof(struct Table)), STRUCT_TABLE_SIZE, true);
+    NewType->Sizeof = Typ->Sizeof;
+    NewType->AlignBytes = Typ->AlignBytes;
+
+    for (Count = 0; Count < Typ->Members->Size; Count++)
+    {
+        for (Entry = Typ->Members->HashTable[Count]; Entry != nullptr; Entry = Entry->Next)
+        {
+            MemberValue = VariableAllocValueAndData(To, nullptr, sizeof(int), false, nullptr, true);
+            MemberValue->Typ = TypeCopy(pc, To, Entry->p.v.Val->Typ);
+            MemberValue->Val->Integer = Entry->p.v.Val->Val->Integer;
+            TableSet(To, NewType->Members, TableStrRegister(To, Entry->p.v.Key), MemberValue, (Entry->DeclFileName != nullptr) ? TableStrRegister(To, Entry->DeclFileName) : nullptr, Entry->DeclLine, Entry->DeclColumn);
+        }
+    }
+
+    return NewType;
+}
+
+/* copy a type and everything derived from it to To */
+static void TypeCopyNode(Picoc *pc, Picoc *To, struct ValueType *Typ)
+{
+    struct ValueType *SubType;
+
+    for (SubType = Typ->DerivedTypeList; SubType != nullptr; SubType = SubType->Next)
+    {
+        TypeCopy(pc, To, SubType);
+        TypeCopyNode(pc, To, SubType);
+    }
+}
+
+/* copy all of pc's types to To, including structs which only function bodies refer to */
+void TypeCopyAll(Picoc *pc, Picoc *To)
+{
+    TypeCopyNode(pc, To, &pc->UberType);
+}
+
 /* parse an enum declaration */
 void TypeParseEnum(struct ParseState *Parser, struct ValueType **Typ)
 {
@@ -335,7 +401,7 @@ void TypeParseEnum(struct ParseState *Parser, struct ValueType **Typ)
             EnumValue = ExpressionParseInt(Parser);
         }
 
-        VariableDefine(pc, Parser, EnumIdentifier, &InitValue, nullptr, false);
+        VariableDefine(pc, Parser, EnumIdentifier, &InitValue, nullptr, false)->IsConstant = true;
 
         Token = LexGetToken(Parser, nullptr, true);
         if (Token != TokenComma && Token != TokenRightBrace)
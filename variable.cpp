@@ -6,12 +6,20 @@
 /* maximum size of a value to temporarily copy while we create a variable */
 constexpr int MAX_TMP_COPY_BUF = 256;
 
+/* a static variable's declaration site, as remembered in the static site table */
+struct VariableStaticSite
+{
+    const char *Ident;
+    struct Value *Storage;      /* the mangled-name global which holds the variable */
+};
+
 
 /* initialise the variable system */
 void VariableInit(Picoc *pc)
 {
 	TableInitTable(&(pc->GlobalTable), &(pc->GlobalHashTable)[0], GLOBAL_TABLE_SIZE, true);
 	TableInitTable(&pc->StringLiteralTable, &pc->StringLiteralHashTable[0], STRING_LITERAL_TABLE_SIZE, true);
+	TableInitTable(&pc->StaticSiteTable, &pc->StaticSiteHashTable[0], STATIC_SITE_TABLE_SIZE, true);
 	pc->TopStackFrame = nullptr;
 }
 
@@ -38,7 +46,7 @@ void VariableFree(Picoc *pc, struct Value *Val)
         HeapFreeMem(pc, Val);
 }
 
-/* deallocate the global table and the string literal table */
+/* deallocate the values in a table and the table entries */
 void VariableTableCleanup(Picoc *pc, struct Table *HashTable)
 {
     struct TableEntry *Entry;
@@ -62,6 +70,7 @@ void VariableCleanup(Picoc *pc)
 {
     VariableTableCleanup(pc, &pc->GlobalTable);
     VariableTableCleanup(pc, &pc->StringLiteralTable);
+    VariableTableCleanup(pc, &pc->StaticSiteTable);
 }
 
 /* allocate some memory, either on the heap or the stack and check if we've run out */
@@ -99,6 +108,7 @@ struct Value *VariableAllocValueAndData(Picoc *pc, struct ParseState *Parser, in
         NewValue->ScopeID = Parser->ScopeID;
 
     NewValue->OutOfScope = 0;
+    NewValue->IsConstant = false;
 
     return NewValue;
 }
@@ -142,6 +152,7 @@ struct Value *VariableAllocValueFromExistingData(struct ParseState *Parser, stru
     NewValue->ValOnStack = false;
     NewValue->IsLValue = IsLValue;
     NewValue->LValueFrom = LValueFrom;
+    NewValue->IsConstant = false;
 
     return NewValue;
 }
@@ -168,6 +179,7 @@ int VariableScopeBegin(struct ParseState * Parser, int* OldScopeID)
     struct TableEntry *NextEntry;
     Picoc * pc = Parser->pc;
     int Count;
+    unsigned int ScopeHash;
     #ifdef VAR_SCOPE_DEBUG
     int FirstPrint = 0;
     #endif
@@ -176,9 +188,19 @@ int VariableScopeBegin(struct ParseState * Parser, int* OldScopeID)
 
     if (Parser->ScopeID == -1) return -1;
 
-    /* XXX dumb hash, let's hope for no collisions... */
+    /* XXX dumb hash, let's hope for no collisions... interactive input has no source text so
+     * it's left out of the hash rather than making every block's scope zero. it's worked out
+     * unsigned so it can wrap around */
     *OldScopeID = Parser->ScopeID;
-    Parser->ScopeID = (int)(intptr_t)(Parser->SourceText) * ((int)(intptr_t)(Parser->Pos) / sizeof(char*));
+    ScopeHash = (unsigned int)(intptr_t)(Parser->Pos) / sizeof(char*);
+    if (Parser->SourceText != nullptr)
+        ScopeHash *= (unsigned int)(intptr_t)(Parser->SourceText);
+
+    Parser->ScopeID = (int)ScopeHash;
+
+    /* 0 is the outermost scope and -1 turns scoping off, so a block can't have either */
+    if (Parser->ScopeID == 0 || Parser->ScopeID == -1)
+        Parser->ScopeID = 1;
     /* or maybe a more human-readable hash for debugging? */
     /* Parser->ScopeID = Parser->Line * 0x10000 + Parser->CharacterPos; */
 
@@ -281,11 +303,77 @@ struct Value *VariableDefine(Picoc *pc, struct ParseState *Parser, char *Ident,
     return AssignValue;
 }
 
+/* find or create the global storage of the static variable declared at the parser's position.
+ * the storage is remembered by declaration site so later visits don't have to look it up by name */
+static struct Value *VariableStaticStorage(struct ParseState *Parser, char *Ident, struct ValueType *Typ, int *FirstVisit)
+{
+    Picoc *pc = Parser->pc;
+    struct Value *ExistingValue;
+    struct Value *SiteValue;
+    struct VariableStaticSite *Site;
+    const char *DeclFileName;
+    int DeclLine;
+    int DeclColumn;
+    char MangledName[LINEBUFFER_MAX];
+    char *MNPos = &MangledName[0];
+    char *MNEnd = &MangledName[LINEBUFFER_MAX-1];
+    const char *RegisteredMangledName;
+
+    if (TableGet(&pc->StaticSiteTable, (const char *)Parser->Pos, &SiteValue, &DeclFileName, &DeclLine, &DeclColumn))
+    {
+        /* a different declaration with the same shape can reuse freed tokens, so check the name too */
+        Site = (struct VariableStaticSite *)SiteValue->Val;
+        if (DeclFileName == Parser->FileName && DeclLine == Parser->Line && DeclColumn == Parser->CharacterPos && Site->Ident == Ident && Site->Storage->Typ == Typ)
+            return Site->Storage;
+
+        /* the tokens at this position have been freed and reused for another declaration */
+        VariableFree(pc, TableDelete(pc, &pc->StaticSiteTable, (const char *)Parser->Pos));
+    }
+
+    /* make the mangled static name (avoiding using sprintf() to minimise library impact) */
+    memset((void *)&MangledName, '\0', sizeof(MangledName));
+    *MNPos++ = '/';
+    strncpy(MNPos, (char *)Parser->FileName, MNEnd - MNPos);
+    MNPos += strlen(MNPos);
+
+    if (pc->TopStackFrame != nullptr)
+    {
+        /* we're inside a function */
+        if (MNEnd - MNPos > 0) *MNPos++ = '/';
+        strncpy(MNPos, (char *)pc->TopStackFrame->FuncName, MNEnd - MNPos);
+        MNPos += strlen(MNPos);
+    }
+
+    if (MNEnd - MNPos > 0) *MNPos++ = '/';
+    strncpy(MNPos, Ident, MNEnd - MNPos);
+    RegisteredMangledName = TableStrRegister(pc, MangledName);
+
+    /* is this static already defined? */
+    if (!TableGet(&pc->GlobalTable, RegisteredMangledName, &ExistingValue, &DeclFileName, &DeclLine, &DeclColumn))
+    {
+        /* define the mangled-named static variable store in the global scope */
+        ExistingValue = VariableAllocValueFromType(pc, Parser, Typ, true, nullptr, true);
+        TableSet(pc, &pc->GlobalTable, (char *)RegisteredMangledName, ExistingValue, (char *)Parser->FileName, Parser->Line, Parser->CharacterPos);
+        *FirstVisit = true;
+    }
+
+    /* remember it by declaration site. the site only refers to the storage, it doesn't own it */
+    SiteValue = VariableAllocValueAndData(pc, Parser, sizeof(struct VariableStaticSite), false, nullptr, true);
+    SiteValue->Typ = &pc->VoidType;
+    Site = (struct VariableStaticSite *)SiteValue->Val;
+    Site->Ident = Ident;
+    Site->Storage = ExistingValue;
+    TableSet(pc, &pc->StaticSiteTable, (char *)Parser->Pos, SiteValue, Parser->FileName, Parser->Line, Parser->CharacterPos);
+
+    return ExistingValue;
+}
+
 /* define a variable. Ident must be registered. If it's a redefinition from the same declaration don't throw an error */
 struct Value *VariableDefineButIgnoreIdentical(struct ParseState *Parser, char *Ident, struct ValueType *Typ, int IsStatic, int *FirstVisit)
 {
     Picoc *pc = Parser->pc;
     struct Value *ExistingValue;
+    struct Table *CurrentTable = (pc->TopStackFrame == nullptr) ? &pc->GlobalTable : &pc->TopStackFrame->LocalTable;
     const char *DeclFileName;
     int DeclLine;
     int DeclColumn;
@@ -294,52 +382,26 @@ struct Value *VariableDefineButIgnoreIdentical(struct ParseState *Parser, char *
     if (TypeIsForwardDeclared(Parser, Typ))
         ProgramFail(Parser, "type '%t' isn't defined", Typ);
 
+    if (Parser->Line != 0 && TableGet(CurrentTable, Ident, &ExistingValue, &DeclFileName, &DeclLine, &DeclColumn)
+            && DeclFileName == Parser->FileName && DeclLine == Parser->Line && DeclColumn == Parser->CharacterPos)
+        return ExistingValue;
+
     if (IsStatic)
     {
-        char MangledName[LINEBUFFER_MAX];
-        char *MNPos = &MangledName[0];
-        char *MNEnd = &MangledName[LINEBUFFER_MAX-1];
-        const char *RegisteredMangledName;
-
-        /* make the mangled static name (avoiding using sprintf() to minimise library impact) */
-        memset((void *)&MangledName, '\0', sizeof(MangledName));
-        *MNPos++ = '/';
-        strncpy(MNPos, (char *)Parser->FileName, MNEnd - MNPos);
-        MNPos += strlen(MNPos);
+        struct Value *StorageValue = VariableStaticStorage(Parser, Ident, Typ, FirstVisit);
 
-        if (pc->TopStackFrame != nullptr)
-        {
-            /* we're inside a function */
-            if (MNEnd - MNPos > 0) *MNPos++ = '/';
-            strncpy(MNPos, (char *)pc->TopStackFrame->FuncName, MNEnd - MNPos);
-            MNPos += strlen(MNPos);
-        }
+        /* make a mirroring variable in our own scope with the short name */
+        ExistingValue = VariableAllocValueAndData(pc, Parser, 0, true, nullptr, pc->TopStackFrame == nullptr);
+        ExistingValue->Typ = StorageValue->Typ;
+        ExistingValue->Val = StorageValue->Val;
 
-        if (MNEnd - MNPos > 0) *MNPos++ = '/';
-        strncpy(MNPos, Ident, MNEnd - MNPos);
-        RegisteredMangledName = TableStrRegister(pc, MangledName);
+        if (!TableSet(pc, CurrentTable, Ident, ExistingValue, Parser->FileName, Parser->Line, Parser->CharacterPos))
+            ProgramFail(Parser, "'%s' is already defined", Ident);
 
-        /* is this static already defined? */
-        if (!TableGet(&pc->GlobalTable, RegisteredMangledName, &ExistingValue, &DeclFileName, &DeclLine, &DeclColumn))
-        {
-            /* define the mangled-named static variable store in the global scope */
-            ExistingValue = VariableAllocValueFromType(Parser->pc, Parser, Typ, true, nullptr, true);
-            TableSet(pc, &pc->GlobalTable, (char *)RegisteredMangledName, ExistingValue, (char *)Parser->FileName, Parser->Line, Parser->CharacterPos);
-            *FirstVisit = true;
-        }
-
-        /* static variable exists in the global scope - now make a mirroring variable in our own scope with the short name */
-        VariableDefinePlatformVar(Parser->pc, Parser, Ident, ExistingValue->Typ, ExistingValue->Val, true);
         return ExistingValue;
     }
     else
-    {
-        if (Parser->Line != 0 && TableGet((pc->TopStackFrame == nullptr) ? &pc->GlobalTable : &pc->TopStackFrame->LocalTable, Ident, &ExistingValue, &DeclFileName, &DeclLine, &DeclColumn)
-                && DeclFileName == Parser->FileName && DeclLine == Parser->Line && DeclColumn == Parser->CharacterPos)
-            return ExistingValue;
-        else
-            return VariableDefine(Parser->pc, Parser, Ident, nullptr, Typ, true);
-    }
+        return VariableDefine(pc, Parser, Ident, nullptr, Typ, true);
 }
 
 /* check if a variable with a given name is defined. Ident must be registered */